@@ -0,0 +1,101 @@
+/*! @file
+ * @brief  Partitioning of the SFC key space into contiguous per-rank ranges
+ *
+ * @author Sebastian Keller <sebastian.f.keller@gmail.com>
+ *
+ * With a cornerstone tree that is identical on all ranks, each rank is assigned a contiguous range of leaves.
+ * The key range of a rank is then delimited by the start keys of its first and one-past-last leaves. Since the
+ * particles of a rank are sorted by key, the particles it has to send to another rank form a contiguous range,
+ * found by binary search of the key range boundaries.
+ *
+ * The leaf weights that determine the split points can be particle counts or, for a better balance of the actual
+ * work, the summed costs of the particles in each leaf, e.g. their neighbor counts from the previous step.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <numeric>
+#include <vector>
+
+#include "../tree/csarray.hpp"
+
+namespace cstone
+{
+
+template<class KeyType>
+struct SfcAssignment
+{
+    //! @brief index of the first leaf of each rank, length numRanks + 1
+    std::vector<TreeNodeIndex> leafStart;
+    //! @brief rank r owns the keys in [keyStart[r], keyStart[r+1]), length numRanks + 1
+    std::vector<KeyType> keyStart;
+
+    int numRanks() const { return int(keyStart.size()) - 1; }
+
+    //! @brief the rank that owns @p key
+    int findRank(KeyType key) const
+    {
+        return int(std::upper_bound(keyStart.begin(), keyStart.end(), key) - keyStart.begin()) - 1;
+    }
+};
+
+/*! @brief split the leaves of a cornerstone tree into contiguous ranges of equal total weight
+ *
+ * @param[in] tree         cornerstone leaves, identical on all ranks, length numLeaves + 1
+ * @param[in] leafWeights  weight of each leaf, e.g. the global particle count
+ * @param[in] numLeaves    number of leaves
+ * @param[in] numRanks     number of ranges to create
+ * @return                 the assignment of leaves and keys to ranks
+ *
+ * The boundary between rank r-1 and r is placed at the first leaf at which the accumulated weight reaches
+ * r / numRanks of the total. The deviation from perfect balance is therefore bounded by the heaviest leaf.
+ */
+template<class KeyType, class Weight>
+SfcAssignment<KeyType>
+makeSfcAssignment(const KeyType* tree, const Weight* leafWeights, TreeNodeIndex numLeaves, int numRanks)
+{
+    std::vector<std::size_t> splits = weightedBlockRanges(leafWeights, numLeaves, numRanks);
+
+    SfcAssignment<KeyType> assignment;
+    assignment.leafStart.assign(splits.begin(), splits.end());
+    assignment.keyStart.resize(numRanks + 1);
+    for (int r = 0; r <= numRanks; ++r)
+    {
+        assignment.keyStart[r] = tree[assignment.leafStart[r]];
+    }
+
+    return assignment;
+}
+
+/*! @brief sum up the costs of the local particles in each leaf
+ *
+ * @param[in]  tree           cornerstone leaves, length numLeaves + 1
+ * @param[in]  numLeaves      number of leaves
+ * @param[in]  particleKeys   SFC-sorted local particle keys
+ * @param[in]  particleCosts  cost of each local particle, e.g. its neighbor count in the previous step
+ * @param[in]  numParticles   number of local particles
+ * @param[out] leafCosts      summed cost of the local particles in each leaf, length numLeaves
+ */
+template<class KeyType, class Cost>
+void computeLeafCosts(const KeyType* tree,
+                      TreeNodeIndex numLeaves,
+                      const KeyType* particleKeys,
+                      const Cost* particleCosts,
+                      std::size_t numParticles,
+                      double* leafCosts)
+{
+    std::fill(leafCosts, leafCosts + numLeaves, 0.0);
+
+    const KeyType* firstKey = std::lower_bound(particleKeys, particleKeys + numParticles, tree[0]);
+    const KeyType* lastKey  = std::lower_bound(firstKey, particleKeys + numParticles, tree[numLeaves]);
+    const Cost*    costs    = particleCosts + (firstKey - particleKeys);
+
+    auto leafStart = [tree](std::size_t i) { return tree[i]; };
+    auto sumCosts  = [leafCosts, costs](std::size_t i, std::size_t first, std::size_t last)
+    { leafCosts[i] = std::accumulate(costs + first, costs + last, 0.0); };
+
+    mergePathRanges(leafStart, numLeaves, firstKey, lastKey - firstKey, sumCosts);
+}
+
+} // namespace cstone
@@ -0,0 +1,126 @@
+/*! @file
+ * @brief  Global cornerstone tree and particle exchange across MPI ranks
+ *
+ * @author Sebastian Keller <sebastian.f.keller@gmail.com>
+ *
+ * Each rank counts its local particles in the leaves of a common tree, and the global counts follow from
+ * an element-wise sum over all ranks. Since all ranks then base the same rebalance decisions on the same
+ * counts, the tree stays identical on all ranks without ever exchanging keys.
+ */
+
+#pragma once
+
+#include <limits>
+#include <numeric>
+#include <type_traits>
+#include <vector>
+
+#include <mpi.h>
+
+#include "../util/reallocate.hpp"
+#include "../util/stl.hpp"
+#include "domain_decomp.hpp"
+#include "mpi_wrappers.hpp"
+
+namespace cstone
+{
+
+/*! @brief global version of updateOctree: a single rebalance/count step with counts summed over all ranks
+ *
+ * @param[in]    firstKey    first local particle SFC key
+ * @param[in]    lastKey     last local particle SFC key
+ * @param[in]    bucketSize  maximum number of particles per node
+ * @param[inout] tree        cornerstone leaves, identical on all ranks
+ * @param[inout] counts      global particle count per leaf
+ * @param[-]     tmpTree     scratch space for the rebalanced tree
+ * @param[-]     nodeOps     scratch space for the rebalance decisions
+ * @return                   true if the tree was not modified, the same value on all ranks
+ *
+ * Local counts are capped such that their sum over all ranks cannot overflow.
+ */
+template<class KeyType>
+bool updateOctreeGlobal(const KeyType* firstKey,
+                        const KeyType* lastKey,
+                        unsigned bucketSize,
+                        std::vector<KeyType>& tree,
+                        std::vector<unsigned>& counts,
+                        std::vector<KeyType>& tmpTree,
+                        std::vector<TreeNodeIndex>& nodeOps)
+{
+    unsigned maxCount = std::numeric_limits<unsigned>::max() / mpiCommSize();
+    bool     converged = updateOctree(firstKey, lastKey, bucketSize, tree, counts, tmpTree, nodeOps, maxCount);
+
+    MPI_Allreduce(MPI_IN_PLACE, counts.data(), nNodes(tree), MPI_UNSIGNED, MPI_SUM, MPI_COMM_WORLD);
+    return converged;
+}
+
+/*! @brief per-leaf sum of particle costs over all ranks, the leaf weights of a cost-balanced SfcAssignment
+ *
+ * @param[in] tree           cornerstone leaves, identical on all ranks
+ * @param[in] keys           SFC-sorted local particle keys
+ * @param[in] particleCosts  cost of each local particle, e.g. its neighbor count in the previous step
+ * @return                   the global cost of each leaf, identical on all ranks
+ */
+template<class KeyType, class Cost>
+std::vector<double>
+globalLeafCosts(const std::vector<KeyType>& tree, const std::vector<KeyType>& keys, const Cost* particleCosts)
+{
+    TreeNodeIndex       numLeaves = nNodes(tree);
+    std::vector<double> leafCosts(numLeaves);
+    computeLeafCosts(tree.data(), numLeaves, keys.data(), particleCosts, keys.size(), leafCosts.data());
+
+    MPI_Allreduce(MPI_IN_PLACE, leafCosts.data(), numLeaves, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    return leafCosts;
+}
+
+/*! @brief send each particle to the rank that owns its key
+ *
+ * @param[in]    assignment  key ranges of all ranks
+ * @param[inout] keys        SFC-sorted local particle keys, replaced by the keys of the particles
+ *                           received from all ranks, again sorted
+ * @param[inout] arrays      particle properties in the same order as @p keys, exchanged and reordered
+ *                           along with the keys
+ *
+ * The particles destined to rank r are those with keys in [keyStart[r], keyStart[r+1]), which form a
+ * contiguous range in @p keys. After a single all-to-all exchange, the received segments each are sorted
+ * but interleaved, so the local arrays are sorted again.
+ */
+template<class KeyType, class... Arrays>
+void exchangeParticles(const SfcAssignment<KeyType>& assignment, std::vector<KeyType>& keys, Arrays&... arrays)
+{
+    int numRanks = assignment.numRanks();
+
+    std::vector<int> sendDispls(numRanks + 1), sendCounts(numRanks);
+    for (int r = 0; r < numRanks; ++r)
+    {
+        sendDispls[r] = std::lower_bound(keys.begin(), keys.end(), assignment.keyStart[r]) - keys.begin();
+    }
+    sendDispls[numRanks] = keys.size();
+    for (int r = 0; r < numRanks; ++r)
+    {
+        sendCounts[r] = sendDispls[r + 1] - sendDispls[r];
+    }
+
+    std::vector<int> recvCounts(numRanks), recvDispls(numRanks + 1);
+    MPI_Alltoall(sendCounts.data(), 1, MPI_INT, recvCounts.data(), 1, MPI_INT, MPI_COMM_WORLD);
+    recvDispls[0] = 0;
+    std::partial_sum(recvCounts.begin(), recvCounts.end(), recvDispls.begin() + 1);
+    std::size_t numRecv = recvDispls[numRanks];
+
+    keys = mpiAlltoallv(keys, sendCounts, sendDispls, recvCounts, recvDispls, numRecv);
+    ((arrays = mpiAlltoallv(arrays, sendCounts, sendDispls, recvCounts, recvDispls, numRecv)), ...);
+
+    std::vector<std::size_t> sfcOrder(numRecv);
+    std::iota(sfcOrder.begin(), sfcOrder.end(), std::size_t(0));
+    sort_by_key(keys.begin(), keys.end(), sfcOrder.begin());
+
+    auto reorder = [&sfcOrder, numRecv](auto& array)
+    {
+        std::decay_t<decltype(array)> temp(numRecv);
+        gather(sfcOrder.data(), numRecv, array.data(), temp.data());
+        swap(array, temp);
+    };
+    (reorder(arrays), ...);
+}
+
+} // namespace cstone
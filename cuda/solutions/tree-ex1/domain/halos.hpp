@@ -0,0 +1,89 @@
+/*! @file
+ * @brief  Discovery of the halo leaves that a rank needs from other ranks for neighbor searches
+ *
+ * @author Sebastian Keller <sebastian.f.keller@gmail.com>
+ *
+ * A local particle i needs all particles within 2h_i, some of which may be owned by other ranks. For each local
+ * leaf, the geometric leaf box is inflated by the largest search radius of its particles and tested against the
+ * nodes of the global tree. Nodes whose key range lies entirely in the local domain are skipped without
+ * descending, so only leaves close to the domain boundary traverse more than a few levels. Every remote leaf
+ * that overlaps an inflated local leaf box is flagged as halo.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "../findneighbors.hpp"
+#include "domain_decomp.hpp"
+
+namespace cstone
+{
+
+/*! @brief flag the leaves of other ranks that may contain neighbors of local particles
+ *
+ * @param[in]  octree      linked version of the global cornerstone tree
+ * @param[in]  centers     geometric center of each node of @p octree
+ * @param[in]  sizes       geometric extent from center of each node of @p octree
+ * @param[in]  box         coordinate bounding box
+ * @param[in]  assignment  leaf and key ranges of all ranks
+ * @param[in]  rank        the local rank
+ * @param[in]  layout      index of the first local particle of each local leaf, length numLocalLeaves + 1
+ * @param[in]  h           smoothing lengths of the local particles in SFC order
+ * @param[out] haloFlags   1 for each remote leaf within the search radius of a local particle, 0 otherwise,
+ *                         length octree.numLeafNodes
+ */
+template<class T, class KeyType>
+void findHalos(const OctreeView<const KeyType>& octree,
+               const Vec3<T>* centers,
+               const Vec3<T>* sizes,
+               const Box<T>& box,
+               const SfcAssignment<KeyType>& assignment,
+               int rank,
+               const LocalIndex* layout,
+               const T* h,
+               int* haloFlags)
+{
+    TreeNodeIndex firstLeaf = assignment.leafStart[rank];
+    TreeNodeIndex lastLeaf  = assignment.leafStart[rank + 1];
+    KeyType       firstKey  = assignment.keyStart[rank];
+    KeyType       lastKey   = assignment.keyStart[rank + 1];
+
+    std::fill(haloFlags, haloFlags + octree.numLeafNodes, 0);
+
+    // true if the node only contains local particles
+    auto isLocal = [&octree, firstKey, lastKey](TreeNodeIndex idx)
+    {
+        KeyType nodeStart = decodePlaceholderBit(octree.prefixes[idx]);
+        KeyType nodeEnd   = nodeStart + nodeRange<KeyType>(decodePrefixLength(octree.prefixes[idx]) / 3);
+        return firstKey <= nodeStart && nodeEnd <= lastKey;
+    };
+
+#pragma omp parallel for schedule(dynamic, 64)
+    for (TreeNodeIndex leaf = firstLeaf; leaf < lastLeaf; ++leaf)
+    {
+        LocalIndex first = layout[leaf - firstLeaf];
+        LocalIndex last  = layout[leaf - firstLeaf + 1];
+        if (first == last) { continue; }
+
+        T             radius     = T(2) * *std::max_element(h + first, h + last);
+        T             radiusSq   = radius * radius;
+        TreeNodeIndex leafNode   = octree.leafToInternal[octree.numInternalNodes + leaf];
+        Vec3<T>       leafCenter = centers[leafNode];
+        Vec3<T>       leafSize   = sizes[leafNode];
+
+        auto overlaps = [&](TreeNodeIndex idx)
+        { return !isLocal(idx) && norm2(minDistance(leafCenter, leafSize, centers[idx], sizes[idx], box)) < radiusSq; };
+
+        auto markHalo = [&octree, haloFlags](TreeNodeIndex idx)
+        {
+#pragma omp atomic write
+            haloFlags[octree.internalToLeaf[idx]] = 1;
+        };
+
+        depthFirstTraversal(octree.childOffsets, overlaps, markHalo);
+    }
+}
+
+} // namespace cstone
@@ -0,0 +1,149 @@
+/*! @file
+ * @brief  Point-to-point exchange of halo particles between MPI ranks
+ *
+ * @author Sebastian Keller <sebastian.f.keller@gmail.com>
+ *
+ * Each rank requests its halo leaves from their owners as lists of contiguous leaf ranges. Since the global
+ * particle counts per leaf are known on all ranks, the receiver can compute the size and the final position of
+ * every incoming message in advance and receives the particles directly into the extended arrays. The local
+ * particles and the halos keep their SFC order: halos from lower ranks are placed in front of the local
+ * particles, halos from higher ranks behind them. The global tree with the resulting layout is then a valid
+ * search tree for the local particles, with zero particles in leaves that are neither local nor halos.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <type_traits>
+#include <vector>
+
+#include <mpi.h>
+
+#include "../util/primitives.hpp"
+#include "domain_decomp.hpp"
+#include "mpi_wrappers.hpp"
+
+namespace cstone
+{
+
+/*! @brief receive the halo particles flagged by findHalos and send the local particles requested by other ranks
+ *
+ * @param[in]    assignment  leaf and key ranges of all ranks
+ * @param[in]    counts      global particle count per leaf
+ * @param[in]    haloFlags   1 for each remote leaf whose particles are needed locally
+ * @param[inout] arrays      local particle properties in SFC order, extended by the halo particles
+ * @return                   index of the first particle of each leaf in the extended arrays, length numLeaves + 1
+ *
+ * The local particles start at index layout[assignment.leafStart[rank]] of the extended arrays.
+ */
+template<class KeyType, class... Arrays>
+std::vector<LocalIndex> exchangeHalos(const SfcAssignment<KeyType>& assignment,
+                                      const std::vector<unsigned>& counts,
+                                      const std::vector<int>& haloFlags,
+                                      Arrays&... arrays)
+{
+    int           rank      = mpiCommRank();
+    int           numRanks  = assignment.numRanks();
+    TreeNodeIndex firstLeaf = assignment.leafStart[rank];
+    TreeNodeIndex lastLeaf  = assignment.leafStart[rank + 1];
+    TreeNodeIndex numLeaves = counts.size();
+
+    std::vector<unsigned> presentCounts(numLeaves);
+    for (TreeNodeIndex i = 0; i < numLeaves; ++i)
+    {
+        bool present     = (firstLeaf <= i && i < lastLeaf) || haloFlags[i];
+        presentCounts[i] = present ? counts[i] : 0;
+    }
+    std::vector<LocalIndex> layout(numLeaves + 1);
+    layout.back() = exclusiveScan(presentCounts.data(), layout.data(), numLeaves, LocalIndex(0));
+
+    /****** Halo requests: ranges of consecutive halo leaves per owner ****************/
+    std::vector<std::vector<TreeNodeIndex>> outgoing(numRanks), incoming(numRanks);
+    for (int r = 0; r < numRanks; ++r)
+    {
+        if (r == rank) { continue; }
+        for (TreeNodeIndex i = assignment.leafStart[r]; i < assignment.leafStart[r + 1]; ++i)
+        {
+            if (!haloFlags[i]) { continue; }
+            if (!outgoing[r].empty() && outgoing[r].back() == i) { outgoing[r].back() = i + 1; }
+            else { outgoing[r].insert(outgoing[r].end(), {i, i + 1}); }
+        }
+    }
+
+    std::vector<int> outgoingSizes(numRanks), incomingSizes(numRanks);
+    for (int r = 0; r < numRanks; ++r)
+    {
+        outgoingSizes[r] = outgoing[r].size();
+    }
+    MPI_Alltoall(outgoingSizes.data(), 1, MPI_INT, incomingSizes.data(), 1, MPI_INT, MPI_COMM_WORLD);
+
+    std::vector<MPI_Request> requests;
+    for (int r = 0; r < numRanks; ++r)
+    {
+        incoming[r].resize(incomingSizes[r]);
+        if (incomingSizes[r] > 0)
+        {
+            requests.emplace_back();
+            MPI_Irecv(incoming[r].data(), incomingSizes[r], MpiType<int>::value(), r, 0, MPI_COMM_WORLD,
+                      &requests.back());
+        }
+        if (outgoingSizes[r] > 0)
+        {
+            requests.emplace_back();
+            MPI_Isend(outgoing[r].data(), outgoingSizes[r], MpiType<int>::value(), r, 0, MPI_COMM_WORLD,
+                      &requests.back());
+        }
+    }
+    MPI_Waitall(requests.size(), requests.data(), MPI_STATUSES_IGNORE);
+
+    /****** Particle exchange, one round of messages per array ****************/
+    // index of the first particle of a local leaf in the local, not yet extended arrays
+    auto localOffset = [&layout, firstLeaf](TreeNodeIndex leaf) { return layout[leaf] - layout[firstLeaf]; };
+
+    int  tag           = 1;
+    auto exchangeArray = [&](auto& array)
+    {
+        using ArrayType = std::decay_t<decltype(array)>;
+        using ValueType = typename ArrayType::value_type;
+
+        ArrayType extended(layout.back());
+        std::copy(array.begin(), array.end(), extended.begin() + layout[firstLeaf]);
+
+        std::vector<std::vector<ValueType>> sendBuffers(numRanks);
+        requests.clear();
+        for (int r = 0; r < numRanks; ++r)
+        {
+            if (r == rank) { continue; }
+
+            LocalIndex recvStart = layout[assignment.leafStart[r]];
+            LocalIndex recvCount = layout[assignment.leafStart[r + 1]] - recvStart;
+            if (recvCount > 0)
+            {
+                requests.emplace_back();
+                MPI_Irecv(extended.data() + recvStart, recvCount, MpiType<ValueType>::value(), r, tag,
+                          MPI_COMM_WORLD, &requests.back());
+            }
+
+            for (std::size_t k = 0; k < incoming[r].size(); k += 2)
+            {
+                sendBuffers[r].insert(sendBuffers[r].end(), array.begin() + localOffset(incoming[r][k]),
+                                      array.begin() + localOffset(incoming[r][k + 1]));
+            }
+            if (!sendBuffers[r].empty())
+            {
+                requests.emplace_back();
+                MPI_Isend(sendBuffers[r].data(), sendBuffers[r].size(), MpiType<ValueType>::value(), r, tag,
+                          MPI_COMM_WORLD, &requests.back());
+            }
+        }
+        MPI_Waitall(requests.size(), requests.data(), MPI_STATUSES_IGNORE);
+
+        swap(array, extended);
+        ++tag;
+    };
+    (exchangeArray(arrays), ...);
+
+    return layout;
+}
+
+} // namespace cstone
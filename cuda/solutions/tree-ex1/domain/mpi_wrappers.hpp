@@ -0,0 +1,95 @@
+/*! @file
+ * @brief  Type mapping and collective helpers for MPI
+ *
+ * @author Sebastian Keller <sebastian.f.keller@gmail.com>
+ */
+
+#pragma once
+
+#include <vector>
+
+#include <mpi.h>
+
+namespace cstone
+{
+
+//! @brief the MPI datatype that corresponds to T
+template<class T>
+struct MpiType;
+
+template<>
+struct MpiType<double>
+{
+    static MPI_Datatype value() { return MPI_DOUBLE; }
+};
+
+template<>
+struct MpiType<float>
+{
+    static MPI_Datatype value() { return MPI_FLOAT; }
+};
+
+template<>
+struct MpiType<int>
+{
+    static MPI_Datatype value() { return MPI_INT; }
+};
+
+template<>
+struct MpiType<unsigned>
+{
+    static MPI_Datatype value() { return MPI_UNSIGNED; }
+};
+
+template<>
+struct MpiType<unsigned long>
+{
+    static MPI_Datatype value() { return MPI_UNSIGNED_LONG; }
+};
+
+template<>
+struct MpiType<unsigned long long>
+{
+    static MPI_Datatype value() { return MPI_UNSIGNED_LONG_LONG; }
+};
+
+inline int mpiCommRank(MPI_Comm comm = MPI_COMM_WORLD)
+{
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    return rank;
+}
+
+inline int mpiCommSize(MPI_Comm comm = MPI_COMM_WORLD)
+{
+    int numRanks;
+    MPI_Comm_size(comm, &numRanks);
+    return numRanks;
+}
+
+/*! @brief all-to-all exchange of variable-sized segments of @p send
+ *
+ * @param[in] send        send buffer, the segment for rank r starts at sendDispls[r]
+ * @param[in] sendCounts  number of elements to send to each rank
+ * @param[in] sendDispls  offsets of the segments in @p send
+ * @param[in] recvCounts  number of elements to receive from each rank
+ * @param[in] recvDispls  offsets of the received segments in the returned buffer
+ * @param[in] numRecv     total number of elements to receive
+ * @return                the received elements, ordered by source rank
+ */
+template<class T>
+std::vector<T> mpiAlltoallv(const std::vector<T>& send,
+                            const std::vector<int>& sendCounts,
+                            const std::vector<int>& sendDispls,
+                            const std::vector<int>& recvCounts,
+                            const std::vector<int>& recvDispls,
+                            std::size_t numRecv,
+                            MPI_Comm comm = MPI_COMM_WORLD)
+{
+    std::vector<T> recv(numRecv);
+    MPI_Alltoallv(send.data(), sendCounts.data(), sendDispls.data(), MpiType<T>::value(), recv.data(),
+                  recvCounts.data(), recvDispls.data(), MpiType<T>::value(), comm);
+    return recv;
+}
+
+} // namespace cstone
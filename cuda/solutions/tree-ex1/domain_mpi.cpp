@@ -0,0 +1,377 @@
+/*! @file
+ * @brief  SFC domain decomposition mini-app: global cornerstone tree, particle and halo exchange with MPI,
+ *         followed by a cost-weighted rebalancing based on the measured neighbor counts
+ *
+ * @author Sebastian Keller <sebastian.f.keller@gmail.com>
+ *
+ * usage: mpirun -n <numRanks> ./domain_mpi <numParticlesPerRank> <distribution>
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <numeric>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <mpi.h>
+
+#include "sfc/hilbert.hpp"
+#include "util/distributions.hpp"
+#include "util/timing.cuh"
+
+#include "domain/domain_decomp_mpi.hpp"
+#include "domain/halos.hpp"
+#include "domain/halos_mpi.hpp"
+#include "tree/focus_octree.hpp"
+
+using namespace cstone;
+
+template<class T, class KeyType>
+void decomposeDomain(std::size_t numParticles, ParticleDistribution distribution)
+{
+    int rank     = mpiCommRank();
+    int numRanks = mpiCommSize();
+
+    Box<T>   box{0, 1};
+    unsigned bucketSize = 64;
+    unsigned ngTarget   = 64;
+    T        theta      = 0.5;
+
+    /****** Local particle data, SFC-sorted per rank ****************/
+    std::vector<T> x(numParticles), y(numParticles), z(numParticles);
+    generateParticles(distribution, x.data(), y.data(), z.data(), numParticles, box, 42 + rank);
+
+    std::vector<KeyType> keys(numParticles);
+    computeSfcKeys(x.data(), y.data(), z.data(), keys.data(), numParticles, box);
+
+    std::vector<std::size_t> sfcOrder(numParticles);
+    std::iota(sfcOrder.begin(), sfcOrder.end(), std::size_t(0));
+    sort_by_key(keys.begin(), keys.end(), sfcOrder.begin());
+
+    std::vector<T> temp(numParticles);
+    for (auto* array : {&x, &y, &z})
+    {
+        gather(sfcOrder.data(), numParticles, array->data(), temp.data());
+        swap(*array, temp);
+    }
+
+    /****** Global tree ****************/
+    std::vector<KeyType>       tree{0, nodeRange<KeyType>(0)}, tmpTree;
+    std::vector<unsigned>      counts{unsigned(numParticles * numRanks)};
+    std::vector<TreeNodeIndex> nodeOps;
+
+    auto buildGlobalTree = [&]()
+    {
+        while (!updateOctreeGlobal(keys.data(), keys.data() + keys.size(), bucketSize, tree, counts, tmpTree,
+                                   nodeOps))
+            ;
+    };
+
+    float treeTime = timeCpu(buildGlobalTree);
+
+    OctreeData<KeyType, CpuTag> octree;
+    octree.resize(nNodes(tree));
+    buildLinkedTree(tree.data(), octree.data());
+
+    std::vector<Vec3<T>> centers(octree.numNodes), sizes(octree.numNodes);
+    nodeFpCenters(octree.prefixes.data(), octree.numNodes, centers.data(), sizes.data(), box);
+
+    /****** Decomposition and exchange ****************/
+    SfcAssignment<KeyType> assignment = makeSfcAssignment(tree.data(), counts.data(), nNodes(tree), numRanks);
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    float exchangeTime = timeCpu([&]() { exchangeParticles(assignment, keys, x, y, z); });
+
+    /****** Verification ****************/
+    std::size_t numLocal = keys.size();
+    std::size_t numAssigned =
+        std::accumulate(counts.begin() + assignment.leafStart[rank], counts.begin() + assignment.leafStart[rank + 1],
+                        std::size_t(0));
+
+    bool pass = std::is_sorted(keys.begin(), keys.end()) && numLocal == numAssigned;
+    for (std::size_t i = 0; i < numLocal; ++i)
+    {
+        pass &= assignment.findRank(keys[i]) == rank && keys[i] == hilbert3D<KeyType>(x[i], y[i], z[i], box);
+    }
+
+    /****** Focused tree of the local domain ****************/
+    FocusedOctreeCore<T, KeyType> focusTree(bucketSize, theta);
+    auto                          buildFocusTree = [&]()
+    {
+        focusTree.update(assignment.keyStart[rank], assignment.keyStart[rank + 1], keys.data(),
+                         keys.data() + keys.size(), tree.data(), counts.data(), nNodes(tree), box);
+    };
+    float focusTime = timeCpu(buildFocusTree);
+
+    // inside the focus, the focused tree must resolve the same leaves as the global tree
+    const auto& focusLeaves = focusTree.csTree();
+    auto        focusFirst  = std::find(focusLeaves.begin(), focusLeaves.end(), assignment.keyStart[rank]);
+    auto        focusLast   = std::find(focusLeaves.begin(), focusLeaves.end(), assignment.keyStart[rank + 1]);
+    pass &= focusFirst != focusLeaves.end() && focusLast != focusLeaves.end() &&
+            std::equal(focusFirst, focusLast + 1, tree.begin() + assignment.leafStart[rank],
+                       tree.begin() + assignment.leafStart[rank + 1] + 1);
+    pass &= std::accumulate(focusTree.counts().begin(), focusTree.counts().end(), std::size_t(0)) ==
+            numParticles * numRanks;
+    unsigned long numFocusLeaves = nNodes(focusLeaves);
+
+    /****** Smoothing lengths from the global leaf densities ****************/
+    std::vector<T> h(numLocal);
+    LocalIndex     leafOffset = 0;
+    for (TreeNodeIndex leaf = assignment.leafStart[rank]; leaf < assignment.leafStart[rank + 1]; ++leaf)
+    {
+        T volume = box.lx() * box.ly() * box.lz() / std::pow(T(8), treeLevel(tree[leaf + 1] - tree[leaf]));
+        T radius = std::cbrt(T(3) / (4 * M_PI) * volume * ngTarget / std::max(counts[leaf], 1u));
+        std::fill(h.begin() + leafOffset, h.begin() + leafOffset + counts[leaf], T(0.5) * radius);
+        leafOffset += counts[leaf];
+    }
+
+    /****** Distributed neighbor search ****************/
+    struct SearchStats
+    {
+        float         haloSearchTime;
+        float         haloExchangeTime;
+        float         searchTime;
+        unsigned long numHalos;
+        //! @brief sum of all neighbor counts
+        double work;
+        //! @brief largest per-thread sum of neighbor counts relative to the mean
+        double threadImbalance;
+    };
+
+    std::vector<unsigned> neighborCounts;
+
+    // halo discovery and exchange, followed by a count-only neighbor search of the local particles, in which each
+    // thread processes a contiguous range of particles with equal total cost. On return, the particle arrays again
+    // contain only the local particles.
+    auto searchWithHalos = [&](const SfcAssignment<KeyType>& domain, const std::vector<unsigned>& costs)
+    {
+        SearchStats   stats;
+        TreeNodeIndex firstLeaf = domain.leafStart[rank];
+        TreeNodeIndex lastLeaf  = domain.leafStart[rank + 1];
+        std::size_t   numOwned  = keys.size();
+
+        std::vector<LocalIndex> localLayout(lastLeaf - firstLeaf + 1);
+        localLayout.back() =
+            exclusiveScan(counts.data() + firstLeaf, localLayout.data(), lastLeaf - firstLeaf, LocalIndex(0));
+
+        std::vector<int> haloFlags(nNodes(tree));
+        auto             discoverHalos = [&]()
+        {
+            findHalos(std::as_const(octree).data(), centers.data(), sizes.data(), box, domain, rank,
+                      localLayout.data(), h.data(), haloFlags.data());
+        };
+        stats.haloSearchTime = timeCpu(discoverHalos);
+
+        std::vector<LocalIndex> layout;
+        MPI_Barrier(MPI_COMM_WORLD);
+        auto exchangeHaloParticles = [&]() { layout = exchangeHalos(domain, counts, haloFlags, keys, x, y, z, h); };
+        stats.haloExchangeTime     = timeCpu(exchangeHaloParticles);
+
+        LocalIndex localStart = layout[firstLeaf];
+        stats.numHalos        = layout.back() - numOwned;
+        pass &= std::is_sorted(keys.begin(), keys.end());
+
+        OctreeNsView<T, KeyType> nsView{centers.data(), sizes.data(), octree.childOffsets.data(),
+                                        octree.internalToLeaf.data(), layout.data()};
+
+        int                      numThreads   = detail::maxThreads();
+        std::vector<std::size_t> threadRanges = weightedBlockRanges(costs.data(), numOwned, numThreads);
+
+        neighborCounts.resize(numOwned);
+        auto searchNeighbors = [&]()
+        {
+            // one weighted block per iteration, all blocks are searched even if fewer threads are available
+#pragma omp parallel for num_threads(numThreads) schedule(static, 1)
+            for (int block = 0; block < numThreads; ++block)
+            {
+                for (std::size_t i = threadRanges[block]; i < threadRanges[block + 1]; ++i)
+                {
+                    neighborCounts[i] = findNeighbors(LocalIndex(localStart + i), x.data(), y.data(), z.data(),
+                                                      h.data(), nsView, box, 0u, static_cast<LocalIndex*>(nullptr));
+                }
+            }
+        };
+        stats.searchTime = timeCpu(searchNeighbors);
+
+        std::vector<double> threadWork(numThreads);
+        for (int t = 0; t < numThreads; ++t)
+        {
+            threadWork[t] = std::accumulate(neighborCounts.begin() + threadRanges[t],
+                                            neighborCounts.begin() + threadRanges[t + 1], 0.0);
+        }
+        stats.work            = std::accumulate(threadWork.begin(), threadWork.end(), 0.0);
+        stats.threadImbalance = *std::max_element(threadWork.begin(), threadWork.end()) * numThreads /
+                                std::max(stats.work, 1.0);
+
+        auto keepLocal = [localStart, numOwned](auto& array)
+        {
+            array.erase(array.begin() + localStart + numOwned, array.end());
+            array.erase(array.begin(), array.begin() + localStart);
+        };
+        keepLocal(keys);
+        keepLocal(x);
+        keepLocal(y);
+        keepLocal(z);
+        keepLocal(h);
+
+        return stats;
+    };
+
+    // without measured costs, all particles are assumed to be equally expensive
+    SearchStats countStats = searchWithHalos(assignment, std::vector<unsigned>(numLocal, 1));
+
+    /****** Reference search on rank 0 with all particles ****************/
+    std::vector<int> recvCounts(numRanks), recvDispls(numRanks + 1);
+    int              numLocalInt = numLocal;
+    MPI_Gather(&numLocalInt, 1, MPI_INT, recvCounts.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);
+    std::partial_sum(recvCounts.begin(), recvCounts.end(), recvDispls.begin() + 1);
+
+    // the local particles of all ranks, concatenated in rank order, are globally SFC-sorted
+    auto gatherOnRoot = [&](const auto* localData)
+    {
+        using ValueType = std::decay_t<decltype(*localData)>;
+        std::vector<ValueType> gathered(recvDispls[numRanks]);
+        MPI_Gatherv(localData, numLocalInt, MpiType<ValueType>::value(), gathered.data(), recvCounts.data(),
+                    recvDispls.data(), MpiType<ValueType>::value(), 0, MPI_COMM_WORLD);
+        return gathered;
+    };
+    auto xAll      = gatherOnRoot(x.data());
+    auto yAll      = gatherOnRoot(y.data());
+    auto zAll      = gatherOnRoot(z.data());
+    auto hAll      = gatherOnRoot(h.data());
+    auto countsAll = gatherOnRoot(neighborCounts.data());
+
+    bool searchPass = true;
+    if (rank == 0 && std::size_t(recvDispls[numRanks]) == numParticles * numRanks)
+    {
+        std::vector<LocalIndex> globalLayout(nNodes(tree) + 1);
+        globalLayout.back() = exclusiveScan(counts.data(), globalLayout.data(), nNodes(tree), LocalIndex(0));
+
+        OctreeNsView<T, KeyType> globalView{centers.data(), sizes.data(), octree.childOffsets.data(),
+                                            octree.internalToLeaf.data(), globalLayout.data()};
+
+#pragma omp parallel for schedule(dynamic, 64) reduction(&& : searchPass)
+        for (int i = 0; i < recvDispls[numRanks]; ++i)
+        {
+            unsigned reference = findNeighbors(LocalIndex(i), xAll.data(), yAll.data(), zAll.data(), hAll.data(),
+                                               globalView, box, 0u, static_cast<LocalIndex*>(nullptr));
+            searchPass         = searchPass && reference == countsAll[i];
+        }
+    }
+
+    /****** Cost-weighted rebalancing ****************/
+    // the neighbor counts of the last search serve as per-particle costs, both across ranks and across threads
+    std::vector<unsigned>  costs          = neighborCounts;
+    std::vector<double>    leafCosts      = globalLeafCosts(tree, keys, costs.data());
+    SfcAssignment<KeyType> costAssignment = makeSfcAssignment(tree.data(), leafCosts.data(), nNodes(tree), numRanks);
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    float rebalanceTime = timeCpu([&]() { exchangeParticles(costAssignment, keys, x, y, z, h, costs); });
+
+    SearchStats costStats = searchWithHalos(costAssignment, costs);
+    // the same particles with unchanged smoothing lengths have to find the same number of neighbors
+    pass &= neighborCounts == costs;
+
+    /****** Report ****************/
+    auto gatherStat = [&](auto value)
+    {
+        std::vector<decltype(value)> values(numRanks);
+        MPI_Gather(&value, 1, MpiType<decltype(value)>::value(), values.data(), 1, MpiType<decltype(value)>::value(),
+                   0, MPI_COMM_WORLD);
+        return values;
+    };
+    unsigned long numCountBalanced = numLocal;
+    unsigned long numCostBalanced  = keys.size();
+
+    auto localCounts     = gatherStat(numCountBalanced);
+    auto costCounts      = gatherStat(numCostBalanced);
+    auto haloCounts      = gatherStat(countStats.numHalos);
+    auto focusCounts     = gatherStat(numFocusLeaves);
+    auto countWork       = gatherStat(countStats.work);
+    auto costWork        = gatherStat(costStats.work);
+    auto countThreadWork = gatherStat(countStats.threadImbalance);
+    auto costThreadWork  = gatherStat(costStats.threadImbalance);
+
+    int allPass = pass;
+    MPI_Allreduce(MPI_IN_PLACE, &allPass, 1, MPI_INT, MPI_LAND, MPI_COMM_WORLD);
+    for (float* time : {&treeTime, &exchangeTime, &focusTime, &countStats.haloSearchTime,
+                        &countStats.haloExchangeTime, &countStats.searchTime, &rebalanceTime, &costStats.searchTime})
+    {
+        MPI_Allreduce(MPI_IN_PLACE, time, 1, MPI_FLOAT, MPI_MAX, MPI_COMM_WORLD);
+    }
+
+    if (rank == 0)
+    {
+        auto maxOverMean = [numRanks](const auto& values)
+        {
+            double sum = std::accumulate(values.begin(), values.end(), 0.0);
+            return double(*std::max_element(values.begin(), values.end())) * numRanks / std::max(sum, 1.0);
+        };
+        auto printPerRank = [](const auto& values)
+        {
+            for (auto v : values)
+            {
+                std::cout << " " << v;
+            }
+        };
+
+        unsigned long numGlobal     = std::accumulate(localCounts.begin(), localCounts.end(), 0ul);
+        double        meanNeighbors = std::accumulate(countsAll.begin(), countsAll.end(), 0.0) / numGlobal;
+
+        std::cout << "global tree build time " << treeTime << " s, " << nNodes(tree) << " leaves" << std::endl;
+        std::cout << "particle exchange time " << exchangeTime << " s" << std::endl;
+        std::cout << "particles per rank:";
+        printPerRank(localCounts);
+        std::cout << ", max/mean " << maxOverMean(localCounts) << std::endl;
+        std::cout << "total particles " << numGlobal << " (expected " << numParticles * numRanks << "), ownership "
+                  << (allPass && numGlobal == numParticles * numRanks ? "PASS" : "FAIL") << std::endl;
+
+        std::cout << "focused tree build time " << focusTime << " s, leaves per rank:";
+        printPerRank(focusCounts);
+        std::cout << " (global tree " << nNodes(tree) << ")" << std::endl;
+
+        std::cout << "halo discovery time " << countStats.haloSearchTime << " s, halo exchange time "
+                  << countStats.haloExchangeTime << " s" << std::endl;
+        std::cout << "halo particles per rank:";
+        for (int r = 0; r < numRanks; ++r)
+        {
+            std::cout << " " << haloCounts[r] << " (" << 100.0 * haloCounts[r] / std::max(localCounts[r], 1ul)
+                      << "%)";
+        }
+        std::cout << std::endl;
+        std::cout << "distributed neighbor search time " << countStats.searchTime << " s, mean neighbors "
+                  << meanNeighbors << ", comparison with single-rank search "
+                  << (allPass && searchPass ? "PASS" : "FAIL") << std::endl;
+
+        std::cout << "cost-weighted rebalancing exchange time " << rebalanceTime << " s, particles per rank:";
+        printPerRank(costCounts);
+        std::cout << std::endl;
+        std::cout << "work max/mean across ranks: " << maxOverMean(countWork) << " count-balanced, "
+                  << maxOverMean(costWork) << " cost-balanced" << std::endl;
+        std::cout << "work max/mean across threads: "
+                  << *std::max_element(countThreadWork.begin(), countThreadWork.end()) << " count-balanced, "
+                  << *std::max_element(costThreadWork.begin(), costThreadWork.end()) << " cost-balanced" << std::endl;
+        std::cout << "neighbor search time " << costStats.searchTime << " s cost-balanced, " << countStats.searchTime
+                  << " s count-balanced, neighbor counts after rebalancing " << (allPass ? "PASS" : "FAIL")
+                  << std::endl;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    MPI_Init(&argc, &argv);
+
+    std::size_t numParticles = (argc > 1) ? std::stoul(argv[1]) : 200000;
+    std::string distribution = (argc > 2) ? argv[2] : "clusters";
+
+    if (mpiCommRank() == 0)
+    {
+        std::cout << "Decomposing " << numParticles << " " << distribution << " particles per rank on "
+                  << mpiCommSize() << " ranks." << std::endl;
+    }
+    decomposeDomain<double, uint64_t>(numParticles, parseDistribution(distribution));
+
+    MPI_Finalize();
+}
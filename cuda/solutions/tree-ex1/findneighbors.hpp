@@ -7,6 +7,8 @@
 #pragma once
 
 #include <cmath>
+#include <cstdint>
+#include <type_traits>
 
 #include "sfc/box.hpp"
 #include "tree/octree.hpp"
@@ -14,9 +16,13 @@
 namespace cstone
 {
 
-//! @brief generic depth-first traversal of an octree that works on CPU and GPU with customizable descent criteria
-template<class C, class A>
-HOST_DEVICE_FUN void depthFirstTraversal(const TreeNodeIndex* childOffsets, C&& continuationCriterion,
+/*! @brief generic depth-first traversal of an octree that works on CPU and GPU with customizable descent criteria
+ *
+ * @p childOffsets is either a pointer to the child offsets of the linked octree or an equivalent accessor,
+ * such as PackedChildOffsets.
+ */
+template<class ChildOffsets, class C, class A>
+HOST_DEVICE_FUN void depthFirstTraversal(const ChildOffsets& childOffsets, C&& continuationCriterion,
                                          A&& endpointAction)
 {
     bool descend = continuationCriterion(0);
@@ -60,6 +66,177 @@ HOST_DEVICE_FUN void depthFirstTraversal(const TreeNodeIndex* childOffsets, C&&
     } while (currentNode != stackBottom);
 }
 
+/*! @brief stackless depth-first traversal with precomputed escape indices, see computeEscapeIndicesCpu
+ *
+ * Visits the same endpoints as depthFirstTraversal, but in strict depth-first order. After a leaf or a node
+ * that fails the continuation criterion, the traversal jumps to the escape index of the node, which skips its
+ * subtree. The escape index 0 of the root marks the end of the traversal.
+ */
+template<class C, class A>
+HOST_DEVICE_FUN void escapeIndexTraversal(const TreeNodeIndex* childOffsets, const TreeNodeIndex* escapeIndices,
+                                          C&& continuationCriterion, A&& endpointAction)
+{
+    bool descend = continuationCriterion(0);
+    if (!descend) return;
+
+    if (childOffsets[0] == 0)
+    {
+        // root node is already the endpoint
+        endpointAction(0);
+        return;
+    }
+
+    TreeNodeIndex node = childOffsets[0];
+    while (node != 0)
+    {
+        if (!continuationCriterion(node)) { node = escapeIndices[node]; }
+        else if (childOffsets[node] == 0)
+        {
+            // leaf -> traversal end-point reached
+            endpointAction(node);
+            node = escapeIndices[node];
+        }
+        else { node = childOffsets[node]; }
+    }
+}
+
+//! @brief stackless traversal if @p escapeIndices are available, depthFirstTraversal otherwise
+template<class C, class A>
+HOST_DEVICE_FUN void traverseTree(const TreeNodeIndex* childOffsets, const TreeNodeIndex* escapeIndices,
+                                  C&& continuationCriterion, A&& endpointAction)
+{
+    if (escapeIndices) { escapeIndexTraversal(childOffsets, escapeIndices, continuationCriterion, endpointAction); }
+    else { depthFirstTraversal(childOffsets, continuationCriterion, endpointAction); }
+}
+
+//! @brief child offsets of packed node records in the format of OctreeNsView::childOffsets, for depthFirstTraversal
+struct PackedChildOffsets
+{
+    const PackedNode* nodes;
+
+    HOST_DEVICE_FUN TreeNodeIndex operator[](TreeNodeIndex i) const { return nodes[i].childOffset(); }
+};
+
+//! @brief coordinate difference @p b - @p a, wrapped to the minimum image if UsePbc is true
+template<bool UsePbc, class T>
+HOST_DEVICE_FUN T pairDelta(T a, T b, T period)
+{
+    if constexpr (UsePbc) { return minImage(b - a, period); }
+    else { return b - a; }
+}
+
+/*! @brief append all particles in [first:last] within the search radius of particle @p i to its neighbor list
+ *
+ * @tparam       UsePbc        wrap coordinate differences to the minimum image in dimensions with non-zero period
+ * @param[in]    i             index of the target particle, excluded from its own neighbor list
+ * @param[in]    target        coordinates of the target particle
+ * @param[in]    radiusSq      squared search radius
+ * @param[in]    first, last   candidate particle range
+ * @param[in]    x,y,z         particle coordinates in SFC order
+ * @param[in]    period        box lengths of periodic dimensions, zero for open dimensions, see periodLengths
+ * @param[in]    ngmax         maximum number of neighbors to store
+ * @param[out]   neighbors     neighbor list of particle @p i
+ * @param[inout] numNeighbors  neighbor count of particle @p i, incremented beyond @p ngmax if the list overflows
+ *
+ * On the CPU, candidates are processed in blocks of simdBlockSize. Squared distances for a whole block are computed
+ * in a vectorized loop, then the passing indices are compressed into the output without branching.
+ */
+template<bool UsePbc, class T>
+HOST_DEVICE_FUN void searchParticleRange(LocalIndex i,
+                                         const Vec3<T>& target,
+                                         T radiusSq,
+                                         LocalIndex first,
+                                         LocalIndex last,
+                                         const T* x,
+                                         const T* y,
+                                         const T* z,
+                                         const Vec3<T>& period,
+                                         unsigned ngmax,
+                                         LocalIndex* neighbors,
+                                         unsigned& numNeighbors)
+{
+    LocalIndex j = first;
+
+#if !defined(__CUDA_ARCH__) && !defined(__HIP_DEVICE_COMPILE__)
+    constexpr LocalIndex simdBlockSize = 8;
+    // same width as T, such that the comparison results need no packing into narrower vector lanes
+    using PassType = std::conditional_t<sizeof(T) == 8, uint64_t, uint32_t>;
+
+    for (; j + simdBlockSize <= last; j += simdBlockSize)
+    {
+        PassType pass[simdBlockSize];
+
+#pragma omp simd
+        for (LocalIndex k = 0; k < simdBlockSize; ++k)
+        {
+            T dx    = pairDelta<UsePbc>(target[0], x[j + k], period[0]);
+            T dy    = pairDelta<UsePbc>(target[1], y[j + k], period[1]);
+            T dz    = pairDelta<UsePbc>(target[2], z[j + k], period[2]);
+            pass[k] = PassType(dx * dx + dy * dy + dz * dz < radiusSq);
+        }
+        // exclude the target itself outside the vector loop, i - j wraps around for i < j
+        if (i - j < simdBlockSize) { pass[i - j] = 0; }
+
+        if (numNeighbors + simdBlockSize <= ngmax)
+        {
+            // compress-store: always write the candidate, but only advance if it passed
+            for (LocalIndex k = 0; k < simdBlockSize; ++k)
+            {
+                neighbors[numNeighbors] = j + k;
+                numNeighbors += pass[k];
+            }
+        }
+        else
+        {
+            for (LocalIndex k = 0; k < simdBlockSize; ++k)
+            {
+                if (pass[k] && numNeighbors < ngmax) { neighbors[numNeighbors] = j + k; }
+                numNeighbors += pass[k];
+            }
+        }
+    }
+#endif
+
+    for (; j < last; ++j)
+    {
+        if (j == i) { continue; }
+        T dx = pairDelta<UsePbc>(target[0], x[j], period[0]);
+        T dy = pairDelta<UsePbc>(target[1], y[j], period[1]);
+        T dz = pairDelta<UsePbc>(target[2], z[j], period[2]);
+        if (dx * dx + dy * dy + dz * dz < radiusSq)
+        {
+            if (numNeighbors < ngmax) { neighbors[numNeighbors] = j; }
+            numNeighbors++;
+        }
+    }
+}
+
+//! @brief searchParticleRange with minimum image distances in the periodic dimensions of @p box
+template<class T>
+HOST_DEVICE_FUN void searchParticleRange(LocalIndex i,
+                                         const Vec3<T>& target,
+                                         T radiusSq,
+                                         LocalIndex first,
+                                         LocalIndex last,
+                                         const T* x,
+                                         const T* y,
+                                         const T* z,
+                                         const Box<T>& box,
+                                         unsigned ngmax,
+                                         LocalIndex* neighbors,
+                                         unsigned& numNeighbors)
+{
+    Vec3<T> period = periodLengths(box);
+    if (period[0] + period[1] + period[2] > T(0))
+    {
+        searchParticleRange<true>(i, target, radiusSq, first, last, x, y, z, period, ngmax, neighbors, numNeighbors);
+    }
+    else
+    {
+        searchParticleRange<false>(i, target, radiusSq, first, last, x, y, z, period, ngmax, neighbors, numNeighbors);
+    }
+}
+
 /*! @brief findNeighbors of particle number @p i within a radius. Works on CPU and GPU.
  *
  * @tparam     T               coordinate type, float or double
@@ -69,11 +246,16 @@ HOST_DEVICE_FUN void depthFirstTraversal(const TreeNodeIndex* childOffsets, C&&
  * @param[in]  y               particle y-coordinates in SFC order
  * @param[in]  z               particle z-coordinates in SFC order
  * @param[in]  h               smoothing lengths (1/2 the search radius) in SFC order
- * @param[in]  tree            octree connectivity and particle indexing
+ * @param[in]  tree            octree connectivity and particle indexing, node boxes are either geometric
+ *                             or tight particle bounding boxes
  * @param[in]  box             coordinate bounding box that was used to calculate the Morton codes
  * @param[in]  ngmax           maximum number of neighbors per particle
  * @param[out] neighbors       output to store the neighbors
  * @return                     neighbor count of particle @p i
+ *
+ * In periodic dimensions of @p box, both node overlap tests and particle distances use the minimum image
+ * convention, such that neighbors across the box faces are found without ghost copies. This requires
+ * search radii 2h below half the box length.
  */
 template<class T, class KeyType>
 HOST_DEVICE_FUN unsigned findNeighbors(LocalIndex i, const T* x, const T* y, const T* z, const T* h,
@@ -94,31 +276,59 @@ HOST_DEVICE_FUN unsigned findNeighbors(LocalIndex i, const T* x, const T* y, con
     };
 
     // checks which particles in a tree node overlap with the target particle search ball
-    auto searchBox = [i, target, radiusSq, &tree, x, y, z, ngmax, neighbors, &numNeighbors](TreeNodeIndex idx)
+    auto searchBox = [i, target, radiusSq, &tree, x, y, z, &box, ngmax, neighbors, &numNeighbors](TreeNodeIndex idx)
     {
         TreeNodeIndex leafIdx       = tree.internalToLeaf[idx];
         LocalIndex    firstParticle = tree.layout[leafIdx];
         LocalIndex    lastParticle  = tree.layout[leafIdx + 1];
 
-        for (LocalIndex j = firstParticle; j < lastParticle; ++j)
-        {
-            if (j == i) { continue; }
-            if (norm2(Vec3<T>{x[j], y[j], z[j]} - target) < radiusSq)
-            {
-                if (numNeighbors < ngmax) { neighbors[numNeighbors] = j; }
-                numNeighbors++;
-            }
-        }
+        searchParticleRange(i, target, radiusSq, firstParticle, lastParticle, x, y, z, box, ngmax, neighbors,
+                            numNeighbors);
+    };
+
+    traverseTree(tree.childOffsets, tree.escapeIndices, overlaps, searchBox);
+
+    return numNeighbors;
+}
+
+/*! @brief findNeighbors specialization for packed node records, see packNodesCpu
+ *
+ * Reads a single 32-byte record per visited node instead of the node box, child offset and leaf layout from
+ * separate arrays. The packed node boxes contain the original ones, so the neighbors are the same.
+ */
+template<class T>
+HOST_DEVICE_FUN unsigned findNeighbors(LocalIndex i, const T* x, const T* y, const T* z, const T* h,
+                                       const PackedNode* nodes, const Box<T>& box, unsigned ngmax,
+                                       LocalIndex* neighbors)
+{
+    Vec3<T>  target{x[i], y[i], z[i]};
+    T        hi           = h[i];
+    T        radiusSq     = 4.0 * hi * hi;
+    unsigned numNeighbors = 0;
+
+    auto overlaps = [target, radiusSq, nodes, &box](TreeNodeIndex idx)
+    {
+        const PackedNode& node = nodes[idx];
+        Vec3<T>           nodeCenter{T(node.center[0]), T(node.center[1]), T(node.center[2])};
+        Vec3<T>           nodeSize{T(node.size[0]), T(node.size[1]), T(node.size[2])};
+        return norm2(minDistance(target, nodeCenter, nodeSize, box)) < radiusSq;
+    };
+
+    auto searchBox = [i, target, radiusSq, nodes, x, y, z, &box, ngmax, neighbors, &numNeighbors](TreeNodeIndex idx)
+    {
+        searchParticleRange(i, target, radiusSq, nodes[idx].firstParticle(), nodes[idx].lastParticle(), x, y, z, box,
+                            ngmax, neighbors, numNeighbors);
     };
 
-    depthFirstTraversal(tree.childOffsets, overlaps, searchBox);
+    depthFirstTraversal(PackedChildOffsets{nodes}, overlaps, searchBox);
 
     return numNeighbors;
 }
 
-//! @brief O(N^2) all-2-all neighbor search for verification
+//! @brief O(N^2) all-2-all neighbor search for verification, with minimum image distances for periodic boxes
 template<class T>
-void findNeighborsAll2All(const T* x, const T* y, const T* z, const T* h, LocalIndex numParticles, unsigned* counts)
+void findNeighborsAll2All(const T* x, const T* y, const T* z, const T* h, LocalIndex numParticles, unsigned* counts,
+                          const Box<T>& box = Box<T>(0, 1))
 {
 #pragma omp parallel for schedule(static)
     for (LocalIndex i = 0; i < numParticles; ++i)
@@ -129,7 +339,7 @@ void findNeighborsAll2All(const T* x, const T* y, const T* z, const T* h, LocalI
 
         unsigned count_i = 0;
         for (LocalIndex j = 0; j < numParticles; ++j)
-            if (norm2(pi - Vec3<T>{x[j], y[j], z[j]}) < ri_sq) count_i++;
+            if (norm2(applyPbc(pi - Vec3<T>{x[j], y[j], z[j]}, box)) < ri_sq) count_i++;
 
         counts[i] = count_i - 1; // subtract self-reference
     }
@@ -0,0 +1,284 @@
+/*! @file
+ * @brief Neighbor search on the CPU with one octree traversal per group of target particles
+ *
+ * @author Sebastian Keller <sebastian.f.keller@gmail.com>
+ *
+ * Consecutive particles in SFC order are spatially close and walk almost identical paths through the tree.
+ * Analogous to the warp-level GPU traversal in findneighbors_warps.cuh, targets are therefore processed
+ * in groups of GroupConfig::targetSize particles: the tree is traversed once with the bounding box of
+ * the group, inflated by the largest search radius in the group, to collect the candidate leaves.
+ * All group members are then tested against the particles of the candidate leaves in a tight loop.
+ *
+ * findNeighborsCsr uses the same group traversal in a count pass followed by a fill pass to produce
+ * exactly sized CSR neighbor lists.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "util/primitives.hpp"
+#include "findneighbors.hpp"
+#include "neighbor_lists.hpp"
+
+namespace cstone
+{
+
+struct GroupConfig
+{
+    //! @brief number of particles per target group
+    static constexpr unsigned targetSize = 32;
+};
+
+/*! @brief compute the bounding box of particles [first:last] and their largest search radius
+ *
+ * @return  box center, box size and the squared maximum search radius 2 * max(h)
+ */
+template<class T>
+util::tuple<Vec3<T>, Vec3<T>, T>
+groupBounds(LocalIndex first, LocalIndex last, const T* x, const T* y, const T* z, const T* h)
+{
+    Vec3<T> lo{x[first], y[first], z[first]};
+    Vec3<T> hi   = lo;
+    T       hmax = h[first];
+    for (LocalIndex i = first + 1; i < last; ++i)
+    {
+        Vec3<T> pos{x[i], y[i], z[i]};
+        lo   = util::min(lo, pos);
+        hi   = util::max(hi, pos);
+        hmax = std::max(hmax, h[i]);
+    }
+    T radius = T(2) * hmax;
+    return {T(0.5) * (hi + lo), T(0.5) * (hi - lo), radius * radius};
+}
+
+/*! @brief append the leaves that overlap the search volume of particles [first:last] to @p candidates
+ *
+ * @param[in]    first, last  target particle range
+ * @param[in]    x,y,z,h      particle coordinates and smoothing lengths in SFC order
+ * @param[in]    tree         octree connectivity and particle indexing
+ * @param[in]    box          coordinate bounding box
+ * @param[inout] candidates   linked tree node indices of the overlapping leaves are appended
+ */
+template<class T, class KeyType>
+void collectGroupCandidates(LocalIndex first,
+                            LocalIndex last,
+                            const T* x,
+                            const T* y,
+                            const T* z,
+                            const T* h,
+                            const OctreeNsView<T, KeyType>& tree,
+                            const Box<T>& box,
+                            std::vector<TreeNodeIndex>& candidates)
+{
+    auto [groupCenter, groupSize, radiusSq] = groupBounds(first, last, x, y, z, h);
+
+    auto overlaps = [groupCenter = groupCenter, groupSize = groupSize, radiusSq = radiusSq, &tree,
+                     &box](TreeNodeIndex idx)
+    { return norm2(minDistance(groupCenter, groupSize, tree.centers[idx], tree.sizes[idx], box)) < radiusSq; };
+
+    auto collectLeaf = [&candidates](TreeNodeIndex idx) { candidates.push_back(idx); };
+
+    traverseTree(tree.childOffsets, tree.escapeIndices, overlaps, collectLeaf);
+}
+
+/*! @brief search the candidate leaves of a group for the neighbors of target particle @p i
+ *
+ * @param[in]    i              target particle index
+ * @param[in]    x,y,z,h        particle coordinates and smoothing lengths in SFC order
+ * @param[in]    tree           octree connectivity and particle indexing
+ * @param[in]    box            coordinate bounding box
+ * @param[in]    candidates     candidate leaf node indices of the group that contains @p i
+ * @param[in]    numCandidates  number of candidates
+ * @param[in]    ngmax          maximum number of neighbors to store
+ * @param[out]   neighbors      neighbor list of particle @p i
+ * @return                      neighbor count of particle @p i, can exceed @p ngmax
+ */
+template<class T, class KeyType>
+unsigned searchGroupCandidates(LocalIndex i,
+                               const T* x,
+                               const T* y,
+                               const T* z,
+                               const T* h,
+                               const OctreeNsView<T, KeyType>& tree,
+                               const Box<T>& box,
+                               const TreeNodeIndex* candidates,
+                               std::size_t numCandidates,
+                               unsigned ngmax,
+                               LocalIndex* neighbors)
+{
+    Vec3<T>  target{x[i], y[i], z[i]};
+    T        radiusSq     = T(4) * h[i] * h[i];
+    unsigned numNeighbors = 0;
+
+    for (std::size_t c = 0; c < numCandidates; ++c)
+    {
+        TreeNodeIndex idx = candidates[c];
+        // cheap rejection of candidate leaves that only overlap the group, but not this target
+        if (norm2(minDistance(target, tree.centers[idx], tree.sizes[idx], box)) >= radiusSq) { continue; }
+
+        TreeNodeIndex leafIdx = tree.internalToLeaf[idx];
+        searchParticleRange(i, target, radiusSq, tree.layout[leafIdx], tree.layout[leafIdx + 1], x, y, z, box, ngmax,
+                            neighbors, numNeighbors);
+    }
+    return numNeighbors;
+}
+
+/*! @brief find neighbors of particles [first:last] with a single traversal for the whole group
+ *
+ * @param[in]  first, last  target particle range, at most GroupConfig::targetSize particles
+ * @param[in]  x,y,z,h      particle coordinates and smoothing lengths in SFC order
+ * @param[in]  tree         octree connectivity and particle indexing
+ * @param[in]  box          coordinate bounding box
+ * @param[in]  ngmax        maximum number of neighbors per particle
+ * @param[out] neighbors    neighbor indices, @p ngmax per particle starting at neighbors + i * ngmax
+ * @param[out] counts       neighbor count per particle
+ * @param[-]   candidates   scratch space for the candidate leaf node indices
+ */
+template<class T, class KeyType>
+void findNeighborsGroup(LocalIndex first,
+                        LocalIndex last,
+                        const T* x,
+                        const T* y,
+                        const T* z,
+                        const T* h,
+                        const OctreeNsView<T, KeyType>& tree,
+                        const Box<T>& box,
+                        unsigned ngmax,
+                        LocalIndex* neighbors,
+                        unsigned* counts,
+                        std::vector<TreeNodeIndex>& candidates)
+{
+    candidates.clear();
+    collectGroupCandidates(first, last, x, y, z, h, tree, box, candidates);
+
+    for (LocalIndex i = first; i < last; ++i)
+    {
+        counts[i] = searchGroupCandidates(i, x, y, z, h, tree, box, candidates.data(), candidates.size(), ngmax,
+                                          neighbors + std::size_t(i) * ngmax);
+    }
+}
+
+/*! @brief find neighbors of all particles with one traversal per group of GroupConfig::targetSize particles
+ *
+ * @param[in]  x,y,z,h       particle coordinates and smoothing lengths in SFC order
+ * @param[in]  numParticles  number of particles
+ * @param[in]  tree          octree connectivity and particle indexing
+ * @param[in]  box           coordinate bounding box
+ * @param[in]  ngmax         maximum number of neighbors per particle
+ * @param[out] neighbors     neighbor indices, @p ngmax per particle, same layout as findNeighbors
+ * @param[out] counts        neighbor count per particle
+ */
+template<class T, class KeyType>
+void findNeighborsGroups(const T* x,
+                         const T* y,
+                         const T* z,
+                         const T* h,
+                         LocalIndex numParticles,
+                         const OctreeNsView<T, KeyType>& tree,
+                         const Box<T>& box,
+                         unsigned ngmax,
+                         LocalIndex* neighbors,
+                         unsigned* counts)
+{
+    LocalIndex numGroups = iceil(numParticles, GroupConfig::targetSize);
+
+#pragma omp parallel
+    {
+        std::vector<TreeNodeIndex> candidates;
+        candidates.reserve(256);
+
+#pragma omp for schedule(dynamic, 4)
+        for (LocalIndex g = 0; g < numGroups; ++g)
+        {
+            LocalIndex first = g * GroupConfig::targetSize;
+            LocalIndex last  = std::min(first + GroupConfig::targetSize, numParticles);
+            findNeighborsGroup(first, last, x, y, z, h, tree, box, ngmax, neighbors, counts, candidates);
+        }
+    }
+}
+
+/*! @brief find neighbors of all particles and store them in exactly sized CSR lists
+ *
+ * @param[in]  x,y,z,h       particle coordinates and smoothing lengths in SFC order
+ * @param[in]  numParticles  number of particles
+ * @param[in]  tree          octree connectivity and particle indexing
+ * @param[in]  box           coordinate bounding box
+ * @param[out] csr           neighbor lists, sorted in ascending order for each particle
+ *
+ * A count pass traverses the tree once per group of GroupConfig::targetSize particles and counts the neighbors
+ * of each particle. The counts are scanned into the CSR offsets, then a fill pass writes the neighbors into the
+ * exactly sized index array. The fill pass reuses the candidate leaves collected by the count pass and does not
+ * traverse the tree again. In contrast to findNeighbors, no neighbors are ever truncated.
+ */
+template<class T, class KeyType>
+void findNeighborsCsr(const T* x,
+                      const T* y,
+                      const T* z,
+                      const T* h,
+                      LocalIndex numParticles,
+                      const OctreeNsView<T, KeyType>& tree,
+                      const Box<T>& box,
+                      NeighborListsCsr& csr)
+{
+    LocalIndex numGroups = iceil(numParticles, GroupConfig::targetSize);
+
+    // the candidates of group g are candidateBuffers[groupThread[g]][groupBegin[g]:groupEnd[g]]
+    std::vector<std::vector<TreeNodeIndex>> candidateBuffers(detail::maxThreads());
+    std::vector<int>                        groupThread(numGroups);
+    std::vector<std::size_t>                groupBegin(numGroups), groupEnd(numGroups);
+
+    csr.offsets.resize(numParticles + 1);
+
+#pragma omp parallel
+    {
+        int   threadNum  = detail::threadNum();
+        auto& candidates = candidateBuffers[threadNum];
+
+#pragma omp for schedule(dynamic, 4)
+        for (LocalIndex g = 0; g < numGroups; ++g)
+        {
+            LocalIndex first = g * GroupConfig::targetSize;
+            LocalIndex last  = std::min(first + GroupConfig::targetSize, numParticles);
+
+            std::size_t begin = candidates.size();
+            collectGroupCandidates(first, last, x, y, z, h, tree, box, candidates);
+            // visit leaves in SFC order to obtain sorted neighbor lists
+            std::sort(candidates.begin() + begin, candidates.end(), [&tree](TreeNodeIndex a, TreeNodeIndex b)
+                      { return tree.internalToLeaf[a] < tree.internalToLeaf[b]; });
+
+            groupThread[g] = threadNum;
+            groupBegin[g]  = begin;
+            groupEnd[g]    = candidates.size();
+
+            for (LocalIndex i = first; i < last; ++i)
+            {
+                csr.offsets[i] = searchGroupCandidates(i, x, y, z, h, tree, box, candidates.data() + begin,
+                                                       candidates.size() - begin, 0, nullptr);
+            }
+        }
+    }
+
+    csr.offsets[numParticles] = exclusiveScan(csr.offsets.data(), csr.offsets.data(), numParticles, std::size_t(0));
+    csr.indices.resize(csr.offsets[numParticles]);
+
+#pragma omp parallel for schedule(dynamic, 4)
+    for (LocalIndex g = 0; g < numGroups; ++g)
+    {
+        LocalIndex first = g * GroupConfig::targetSize;
+        LocalIndex last  = std::min(first + GroupConfig::targetSize, numParticles);
+
+        const TreeNodeIndex* candidates    = candidateBuffers[groupThread[g]].data() + groupBegin[g];
+        std::size_t          numCandidates = groupEnd[g] - groupBegin[g];
+
+        for (LocalIndex i = first; i < last; ++i)
+        {
+            unsigned count = csr.offsets[i + 1] - csr.offsets[i];
+            searchGroupCandidates(i, x, y, z, h, tree, box, candidates, numCandidates, count,
+                                  csr.indices.data() + csr.offsets[i]);
+        }
+    }
+}
+
+} // namespace cstone
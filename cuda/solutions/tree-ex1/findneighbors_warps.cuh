@@ -55,7 +55,7 @@ template<bool UsePbc, class Tc>
 __device__ void countNeighbors(Vec3<Tc> sourceBody,
                                int numLanesValid,
                                const util::array<Vec4<Tc>, TravConfig::nwt>& pos_i,
-                               const Box<Tc>& /*box*/,
+                               const Box<Tc>& box,
                                cstone::LocalIndex sourceBodyIdx,
                                unsigned ngmax,
                                unsigned nc_i[TravConfig::nwt],
@@ -71,7 +71,9 @@ __device__ void countNeighbors(Vec3<Tc> sourceBody,
 #pragma unroll
         for (int k = 0; k < TravConfig::nwt; k++)
         {
-            Tc d2 = norm2(pos_j - makeVec3(pos_i[k]));
+            Vec3<Tc> dX = pos_j - makeVec3(pos_i[k]);
+            if constexpr (UsePbc) { dX = applyPbc(dX, box); }
+            Tc d2 = norm2(dX);
             if (d2 < pos_i[k][3] && d2 > Tc(0.0))
             {
                 if (nc_i[k] < ngmax)
@@ -94,6 +96,16 @@ __device__ __forceinline__ bool cellOverlap(const Vec3<T>& curSrcCenter,
     return norm2(minDistance(curSrcCenter, curSrcSize, targetCenter, targetSize)) == T(0.0);
 }
 
+template<bool UsePbc, class T, std::enable_if_t<UsePbc, int> = 0>
+__device__ __forceinline__ bool cellOverlap(const Vec3<T>& curSrcCenter,
+                                            const Vec3<T>& curSrcSize,
+                                            const Vec3<T>& targetCenter,
+                                            const Vec3<T>& targetSize,
+                                            const Box<T>& box)
+{
+    return norm2(minDistance(curSrcCenter, curSrcSize, targetCenter, targetSize, box)) == T(0.0);
+}
+
 /*! @brief traverse one warp with up to TravConfig::targetSize target bodies down the tree
  *
  * @param[inout] nc_i           output neighbor counts to add to, TravConfig::nwt per lane
@@ -356,9 +368,20 @@ __device__ util::array<unsigned, TravConfig::nwt> traverseNeighbors(cstone::Loca
     // if traversal should be started at node x, then initNode should be set to the first child of x
     int initNode = 1;
 
+    bool anyPbc = box.boundaryX() == BoundaryType::periodic || box.boundaryY() == BoundaryType::periodic ||
+                  box.boundaryZ() == BoundaryType::periodic;
+
     unsigned numP2P;
-    numP2P = traverseWarp<false>(nc_i.data(), warpNidx, ngmax, pos_i, targetCenter, targetSize, x, y, z, h, tree,
-                                 initNode, box, tempQueue, cellQueue);
+    if (anyPbc)
+    {
+        numP2P = traverseWarp<true>(nc_i.data(), warpNidx, ngmax, pos_i, targetCenter, targetSize, x, y, z, h, tree,
+                                    initNode, box, tempQueue, cellQueue);
+    }
+    else
+    {
+        numP2P = traverseWarp<false>(nc_i.data(), warpNidx, ngmax, pos_i, targetCenter, targetSize, x, y, z, h, tree,
+                                     initNode, box, tempQueue, cellQueue);
+    }
     assert(numP2P != 0xFFFFFFFF);
 
     if (laneIdx == 0)
@@ -0,0 +1,118 @@
+/*! @file
+ * @brief  Barnes-Hut gravity mini-app: accuracy against direct summation and throughput
+ *
+ * @author Sebastian Keller <sebastian.f.keller@gmail.com>
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include "util/random.hpp"
+#include "util/timing.cuh"
+
+#include "tree/octree_manager.hpp"
+#include "gravity.hpp"
+
+using namespace cstone;
+
+template<class T, class KeyType>
+void benchmarkGravity(int numParticles, T theta)
+{
+    Box<T> box{-1, 1};
+    T      G   = 1.0;
+    T      eps = 0.0;
+
+    RandomCoordinates<T, KeyType> coords(numParticles, box);
+    std::vector<T>                m(numParticles, T(1) / numParticles);
+
+    const T*       x    = coords.x().data();
+    const T*       y    = coords.y().data();
+    const T*       z    = coords.z().data();
+    const KeyType* keys = coords.keys().data();
+
+    unsigned                  bucketSize = 16;
+    OctreeManager<T, KeyType> tree(bucketSize);
+    tree.update(keys, keys + numParticles, box);
+
+    std::vector<Multipole<T>> multipoles(tree.linkedTree().numNodes);
+    float upsweepTime = timeCpu(
+        [&]() { computeMultipoles(tree.octreeView(), tree.layout().data(), x, y, z, m.data(), multipoles.data()); });
+
+    std::vector<T> ax(numParticles), ay(numParticles), az(numParticles);
+    GravityStats   stats;
+    float          treeTime = timeCpu(
+        [&]()
+        {
+            stats = computeGravity(tree.nsView(), multipoles.data(), x, y, z, m.data(), numParticles, theta, G, eps,
+                                   ax.data(), ay.data(), az.data());
+        });
+
+    size_t numInteractions = stats.numP2P + stats.numM2P;
+    std::cout << "multipole upsweep time " << upsweepTime << " s" << std::endl;
+    std::cout << "tree gravity time " << treeTime << " s, theta " << theta << ", P2P " << stats.numP2P << ", M2P "
+              << stats.numM2P << ", " << numInteractions / treeTime << " interactions/s" << std::endl;
+
+    /****** Stackless traversal with escape indices: same interactions, different summation order ****************/
+    tree.updateEscapeIndices();
+    std::vector<T> axEsc(numParticles), ayEsc(numParticles), azEsc(numParticles);
+    GravityStats   escStats;
+    float          escTime = timeCpu(
+        [&]()
+        {
+            escStats = computeGravity(tree.nsView(), multipoles.data(), x, y, z, m.data(), numParticles, theta, G, eps,
+                                      axEsc.data(), ayEsc.data(), azEsc.data());
+        });
+
+    T maxEscDiff = 0;
+    for (int i = 0; i < numParticles; ++i)
+    {
+        Vec3<T> delta{axEsc[i] - ax[i], ayEsc[i] - ay[i], azEsc[i] - az[i]};
+        maxEscDiff = std::max(maxEscDiff, std::sqrt(norm2(delta) / norm2(Vec3<T>{ax[i], ay[i], az[i]})));
+    }
+    bool escPass = escStats.numP2P == stats.numP2P && escStats.numM2P == stats.numM2P && maxEscDiff < T(1e-10);
+    std::cout << "stackless tree gravity time " << escTime << " s, speedup " << treeTime / escTime
+              << ", max relative difference " << maxEscDiff << ": " << (escPass ? "PASS" : "FAIL") << std::endl;
+
+    /****** Verification: compare against direct summation ****************/
+    // evenly spaced targets against all sources, limited to about 2e9 direct interactions
+    LocalIndex numTargets = std::min<size_t>(numParticles, std::max<size_t>(1000, size_t(2e9) / numParticles));
+
+    std::vector<LocalIndex> targets(numTargets);
+    for (LocalIndex k = 0; k < numTargets; ++k)
+    {
+        targets[k] = size_t(k) * numParticles / numTargets;
+    }
+
+    std::vector<T> axRef(numTargets), ayRef(numTargets), azRef(numTargets);
+    float          directTime = timeCpu(
+        [&]()
+        {
+            directSum(targets.data(), numTargets, x, y, z, m.data(), numParticles, G, eps, axRef.data(), ayRef.data(),
+                      azRef.data());
+        });
+    std::cout << "direct sum time (" << numTargets << " targets) " << directTime << " s, "
+              << double(numTargets) * numParticles / directTime << " interactions/s" << std::endl;
+
+    std::vector<T> relErrors(numTargets);
+    for (LocalIndex k = 0; k < numTargets; ++k)
+    {
+        LocalIndex i = targets[k];
+        Vec3<T>    delta{ax[i] - axRef[k], ay[i] - ayRef[k], az[i] - azRef[k]};
+        Vec3<T>    ref{axRef[k], ayRef[k], azRef[k]};
+        relErrors[k] = std::sqrt(norm2(delta) / norm2(ref));
+    }
+    std::sort(relErrors.begin(), relErrors.end());
+
+    std::cout << "relative acceleration error: median " << relErrors[numTargets / 2] << ", 99th percentile "
+              << relErrors[size_t(0.99 * numTargets)] << ", max " << relErrors.back() << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    int    numParticles = (argc > 1) ? std::stoi(argv[1]) : 20000;
+    double theta        = (argc > 2) ? std::stod(argv[2]) : 0.5;
+
+    std::cout << "Computing gravity for " << numParticles << " particles." << std::endl;
+    benchmarkGravity<double, uint64_t>(numParticles, theta);
+}
@@ -0,0 +1,253 @@
+/*! @file
+ * @brief  Barnes-Hut gravity with monopole and quadrupole moments on the linked octree
+ *
+ * @author Sebastian Keller <sebastian.f.keller@gmail.com>
+ *
+ * Node multipoles are computed with an upsweep: leaves sum up their particles, internal nodes combine
+ * the moments of their children with the parallel axis theorem. The force on each target particle
+ * is obtained with a depth-first traversal that accepts a node as a whole if it is far enough away
+ * relative to its size (opening angle criterion) and otherwise descends. Leaves that are not accepted
+ * are evaluated with direct particle-particle interactions.
+ */
+
+#pragma once
+
+#include <cmath>
+
+#include "findneighbors.hpp"
+#include "tree/upsweep.hpp"
+
+namespace cstone
+{
+
+//! @brief mass, center of mass and traceless quadrupole moment (relative to the center of mass) of a node
+template<class T>
+struct Multipole
+{
+    T       mass;
+    Vec3<T> com;
+    //! @brief Q_ij = sum_k m_k (3 d_i d_j - |d|^2 delta_ij), in the order xx, xy, xz, yy, yz, zz
+    util::array<T, 6> q;
+};
+
+//! @brief add the quadrupole contribution of a point mass @p m at distance @p d to @p q
+template<class T>
+HOST_DEVICE_FUN void addQuadrupole(util::array<T, 6>& q, T m, const Vec3<T>& d)
+{
+    T d2 = norm2(d);
+    q[0] += m * (T(3) * d[0] * d[0] - d2);
+    q[1] += m * T(3) * d[0] * d[1];
+    q[2] += m * T(3) * d[0] * d[2];
+    q[3] += m * (T(3) * d[1] * d[1] - d2);
+    q[4] += m * T(3) * d[1] * d[2];
+    q[5] += m * (T(3) * d[2] * d[2] - d2);
+}
+
+/*! @brief compute the multipole moments of all octree nodes
+ *
+ * @param[in]  tree        octree connectivity
+ * @param[in]  layout      index of the first particle in each cornerstone leaf
+ * @param[in]  x,y,z,m     particle coordinates and masses in SFC order
+ * @param[out] multipoles  output multipole for each node, length = tree.numNodes
+ */
+template<class KeyType, class T>
+void computeMultipoles(const OctreeView<const KeyType>& tree,
+                       const LocalIndex* layout,
+                       const T* x,
+                       const T* y,
+                       const T* z,
+                       const T* m,
+                       Multipole<T>* multipoles)
+{
+    auto leafMultipole = [x, y, z, m](LocalIndex first, LocalIndex last)
+    {
+        Multipole<T> mp{0, {0, 0, 0}, {0, 0, 0, 0, 0, 0}};
+        for (LocalIndex j = first; j < last; ++j)
+        {
+            mp.mass += m[j];
+            mp.com += m[j] * Vec3<T>{x[j], y[j], z[j]};
+        }
+        if (mp.mass == T(0)) { return mp; }
+        mp.com *= T(1) / mp.mass;
+
+        for (LocalIndex j = first; j < last; ++j)
+        {
+            addQuadrupole(mp.q, m[j], Vec3<T>{x[j], y[j], z[j]} - mp.com);
+        }
+        return mp;
+    };
+
+    auto combineChildren = [](const Multipole<T>* c)
+    {
+        Multipole<T> mp{0, {0, 0, 0}, {0, 0, 0, 0, 0, 0}};
+        for (int octant = 0; octant < 8; ++octant)
+        {
+            mp.mass += c[octant].mass;
+            mp.com += c[octant].mass * c[octant].com;
+        }
+        if (mp.mass == T(0)) { return mp; }
+        mp.com *= T(1) / mp.mass;
+
+        // shift the child moments to the new center of mass (parallel axis theorem)
+        for (int octant = 0; octant < 8; ++octant)
+        {
+            mp.q += c[octant].q;
+            addQuadrupole(mp.q, c[octant].mass, c[octant].com - mp.com);
+        }
+        return mp;
+    };
+
+    upsweep(tree, layout, multipoles, leafMultipole, combineChildren);
+}
+
+//! @brief acceleration at @p target due to the monopole and quadrupole moment of @p mp
+template<class T>
+HOST_DEVICE_FUN Vec3<T> multipole2Particle(const Vec3<T>& target, const Multipole<T>& mp, T G)
+{
+    Vec3<T> r     = target - mp.com;
+    T       r2    = norm2(r);
+    T       invR  = T(1) / std::sqrt(r2);
+    T       invR2 = invR * invR;
+    T       invR3 = invR * invR2;
+    T       invR5 = invR3 * invR2;
+
+    const auto& q = mp.q;
+    Vec3<T> Qr{q[0] * r[0] + q[1] * r[1] + q[2] * r[2], q[1] * r[0] + q[3] * r[1] + q[4] * r[2],
+               q[2] * r[0] + q[4] * r[1] + q[5] * r[2]};
+    T       rQr = dot(r, Qr);
+
+    return G * (-mp.mass * invR3 * r + invR5 * Qr - T(2.5) * rQr * invR5 * invR2 * r);
+}
+
+/*! @brief acceleration at @p target due to the particles [first:last], vectorizable
+ *
+ * The self-interaction (zero distance) contributes zero if @p eps2 is zero.
+ */
+template<class T>
+Vec3<T> particle2Particle(const Vec3<T>& target, LocalIndex first, LocalIndex last, const T* x, const T* y,
+                          const T* z, const T* m, T G, T eps2)
+{
+    T ax = 0, ay = 0, az = 0;
+
+#pragma omp simd reduction(+ : ax, ay, az)
+    for (LocalIndex j = first; j < last; ++j)
+    {
+        T dx   = x[j] - target[0];
+        T dy   = y[j] - target[1];
+        T dz   = z[j] - target[2];
+        T r2   = dx * dx + dy * dy + dz * dz + eps2;
+        T invR = r2 > T(0) ? T(1) / std::sqrt(r2) : T(0);
+        T mr3  = m[j] * invR * invR * invR;
+
+        ax += mr3 * dx;
+        ay += mr3 * dy;
+        az += mr3 * dz;
+    }
+
+    return G * Vec3<T>{ax, ay, az};
+}
+
+//! @brief number of particle-particle and multipole-particle interactions evaluated
+struct GravityStats
+{
+    size_t numP2P{0};
+    size_t numM2P{0};
+};
+
+/*! @brief compute gravitational accelerations with a Barnes-Hut tree walk
+ *
+ * @param[in]  tree          octree connectivity, particle layout and geometrical node boxes
+ * @param[in]  multipoles    node multipoles, see computeMultipoles
+ * @param[in]  x,y,z,m       particle coordinates and masses in SFC order
+ * @param[in]  numParticles  number of particles
+ * @param[in]  theta         opening angle, nodes with edge length < theta * distance to their center of mass
+ *                           are accepted
+ * @param[in]  G             gravitational constant
+ * @param[in]  eps           Plummer softening length of the particle-particle interactions
+ * @param[out] ax,ay,az      output accelerations
+ * @return                   interaction counts
+ */
+template<class T, class KeyType>
+GravityStats computeGravity(const OctreeNsView<T, KeyType>& tree,
+                            const Multipole<T>* multipoles,
+                            const T* x,
+                            const T* y,
+                            const T* z,
+                            const T* m,
+                            LocalIndex numParticles,
+                            T theta,
+                            T G,
+                            T eps,
+                            T* ax,
+                            T* ay,
+                            T* az)
+{
+    size_t numP2P = 0, numM2P = 0;
+    T      eps2   = eps * eps;
+
+#pragma omp parallel for schedule(static) reduction(+ : numP2P, numM2P)
+    for (LocalIndex i = 0; i < numParticles; ++i)
+    {
+        Vec3<T> target{x[i], y[i], z[i]};
+        Vec3<T> acc{0, 0, 0};
+
+        auto descend = [&](TreeNodeIndex idx)
+        {
+            const Vec3<T>& size = tree.sizes[idx];
+            T edgeLength        = T(2) * util::max(size);
+            T d2                = norm2(target - multipoles[idx].com);
+
+            // never accept a node that contains the target
+            bool inside = norm2(minDistance(target, tree.centers[idx], size)) == T(0);
+            if (inside || edgeLength * edgeLength >= theta * theta * d2) { return true; }
+
+            if (multipoles[idx].mass > T(0))
+            {
+                acc += multipole2Particle(target, multipoles[idx], G);
+                numM2P++;
+            }
+            return false;
+        };
+
+        auto leafInteraction = [&](TreeNodeIndex idx)
+        {
+            TreeNodeIndex leafIdx = tree.internalToLeaf[idx];
+            LocalIndex    first   = tree.layout[leafIdx];
+            LocalIndex    last    = tree.layout[leafIdx + 1];
+            acc += particle2Particle(target, first, last, x, y, z, m, G, eps2);
+            numP2P += last - first;
+        };
+
+        traverseTree(tree.childOffsets, tree.escapeIndices, descend, leafInteraction);
+
+        ax[i] = acc[0];
+        ay[i] = acc[1];
+        az[i] = acc[2];
+    }
+
+    return {numP2P, numM2P};
+}
+
+/*! @brief direct summation reference for a subset of target particles against all sources
+ *
+ * @param[in]  targets       indices of the target particles
+ * @param[in]  numTargets    number of targets
+ * @param[in]  numParticles  number of source particles
+ * @param[out] ax,ay,az      accelerations of the targets, length @p numTargets
+ */
+template<class T>
+void directSum(const LocalIndex* targets, LocalIndex numTargets, const T* x, const T* y, const T* z, const T* m,
+               LocalIndex numParticles, T G, T eps, T* ax, T* ay, T* az)
+{
+#pragma omp parallel for schedule(static)
+    for (LocalIndex k = 0; k < numTargets; ++k)
+    {
+        LocalIndex i   = targets[k];
+        Vec3<T>    acc = particle2Particle(Vec3<T>{x[i], y[i], z[i]}, 0, numParticles, x, y, z, m, G, eps * eps);
+        ax[k]          = acc[0];
+        ay[k]          = acc[1];
+        az[k]          = acc[2];
+    }
+}
+
+} // namespace cstone
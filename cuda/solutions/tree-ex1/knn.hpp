@@ -0,0 +1,225 @@
+/*! @file
+ * @brief  Exact k-nearest neighbor queries on the linked octree
+ *
+ * @author Sebastian Keller <sebastian.f.keller@gmail.com>
+ *
+ * Queries use a best-first traversal: tree nodes are visited in order of increasing distance to the query point,
+ * managed by a min-priority queue. The k closest particles found so far are kept in a bounded max-heap, whose
+ * top is the current k-th nearest distance. The traversal stops as soon as the closest unvisited node is farther
+ * away than this distance, which means that all nodes that can still contain a closer particle have been visited.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "findneighbors.hpp"
+
+namespace cstone
+{
+
+//! @brief per-thread scratch space for k-NN queries, reused across queries to avoid allocations
+template<class T>
+struct KnnScratch
+{
+    //! @brief (squared distance, node index) pairs, organized as min-heap
+    std::vector<std::pair<T, TreeNodeIndex>> nodeQueue;
+    //! @brief (squared distance, particle index) pairs, organized as max-heap of at most k elements
+    std::vector<std::pair<T, LocalIndex>> candidates;
+};
+
+/*! @brief find the k nearest particles of a query point
+ *
+ * @param[in]    query      query point coordinates
+ * @param[in]    exclude    particle index to exclude from the result, e.g. the query particle itself,
+ *                          or a value >= the number of particles to exclude nothing
+ * @param[in]    k          number of neighbors to find
+ * @param[in]    x,y,z      particle coordinates in SFC order
+ * @param[in]    tree       octree connectivity, node boxes and particle layout
+ * @param[in]    box        coordinate bounding box, distances use the minimum image in periodic dimensions
+ * @param[-]     scratch    scratch space
+ * @param[out]   neighbors  indices of the nearest particles, sorted by increasing distance, length k
+ * @param[out]   distSq     squared distances of the nearest particles, length k
+ * @return                  number of neighbors found, less than k only if there are fewer particles
+ */
+template<class T, class KeyType>
+unsigned knnQuery(const Vec3<T>& query,
+                  LocalIndex exclude,
+                  unsigned k,
+                  const T* x,
+                  const T* y,
+                  const T* z,
+                  const OctreeNsView<T, KeyType>& tree,
+                  const Box<T>& box,
+                  KnnScratch<T>& scratch,
+                  LocalIndex* neighbors,
+                  T* distSq)
+{
+    auto& nodeQueue  = scratch.nodeQueue;
+    auto& candidates = scratch.candidates;
+    nodeQueue.clear();
+    candidates.clear();
+    if (k == 0) { return 0; }
+
+    auto closerFirst = [](const auto& a, const auto& b) { return a.first > b.first; };
+    Vec3<T> period   = periodLengths(box);
+
+    auto nodeDistSq = [&](TreeNodeIndex idx)
+    { return norm2(minDistance(query, tree.centers[idx], tree.sizes[idx], box)); };
+
+    // k-th nearest squared distance found so far, no pruning until k candidates are found
+    auto bound = [&]() { return candidates.size() < k ? std::numeric_limits<T>::max() : candidates.front().first; };
+
+    nodeQueue.emplace_back(nodeDistSq(0), 0);
+    while (!nodeQueue.empty())
+    {
+        std::pop_heap(nodeQueue.begin(), nodeQueue.end(), closerFirst);
+        auto [nodeDist, idx] = nodeQueue.back();
+        nodeQueue.pop_back();
+
+        if (nodeDist >= bound()) { break; }
+
+        TreeNodeIndex firstChild = tree.childOffsets[idx];
+        if (firstChild == 0)
+        {
+            TreeNodeIndex leafIdx = tree.internalToLeaf[idx];
+            for (LocalIndex j = tree.layout[leafIdx]; j < tree.layout[leafIdx + 1]; ++j)
+            {
+                if (j == exclude) { continue; }
+                T dx = minImage(x[j] - query[0], period[0]);
+                T dy = minImage(y[j] - query[1], period[1]);
+                T dz = minImage(z[j] - query[2], period[2]);
+                T d2 = dx * dx + dy * dy + dz * dz;
+
+                if (candidates.size() < k)
+                {
+                    candidates.emplace_back(d2, j);
+                    std::push_heap(candidates.begin(), candidates.end());
+                }
+                else if (d2 < candidates.front().first)
+                {
+                    std::pop_heap(candidates.begin(), candidates.end());
+                    candidates.back() = {d2, j};
+                    std::push_heap(candidates.begin(), candidates.end());
+                }
+            }
+        }
+        else
+        {
+            T currentBound = bound();
+            for (TreeNodeIndex child = firstChild; child < firstChild + 8; ++child)
+            {
+                T childDist = nodeDistSq(child);
+                if (childDist < currentBound)
+                {
+                    nodeQueue.emplace_back(childDist, child);
+                    std::push_heap(nodeQueue.begin(), nodeQueue.end(), closerFirst);
+                }
+            }
+        }
+    }
+
+    std::sort_heap(candidates.begin(), candidates.end());
+    for (std::size_t n = 0; n < candidates.size(); ++n)
+    {
+        distSq[n]    = candidates[n].first;
+        neighbors[n] = candidates[n].second;
+    }
+    return candidates.size();
+}
+
+/*! @brief find the k nearest neighbors of all particles, excluding the particles themselves
+ *
+ * @param[in]  x,y,z         particle coordinates in SFC order
+ * @param[in]  numParticles  number of particles
+ * @param[in]  tree          octree connectivity, node boxes and particle layout
+ * @param[in]  box           coordinate bounding box
+ * @param[in]  k             number of neighbors per particle
+ * @param[out] neighbors     k neighbor indices per particle, sorted by distance, starting at neighbors + i * k
+ * @param[out] distSq        corresponding squared distances, same layout as @p neighbors
+ *
+ * If there are fewer than k other particles, the remaining entries are filled with the index @p numParticles
+ * and the distance numeric_limits<T>::max().
+ */
+template<class T, class KeyType>
+void knnParticles(const T* x,
+                  const T* y,
+                  const T* z,
+                  LocalIndex numParticles,
+                  const OctreeNsView<T, KeyType>& tree,
+                  const Box<T>& box,
+                  unsigned k,
+                  LocalIndex* neighbors,
+                  T* distSq)
+{
+#pragma omp parallel
+    {
+        KnnScratch<T> scratch;
+
+#pragma omp for schedule(static)
+        for (LocalIndex i = 0; i < numParticles; ++i)
+        {
+            LocalIndex* iNeighbors = neighbors + std::size_t(i) * k;
+            T*          iDistSq    = distSq + std::size_t(i) * k;
+
+            unsigned found =
+                knnQuery(Vec3<T>{x[i], y[i], z[i]}, i, k, x, y, z, tree, box, scratch, iNeighbors, iDistSq);
+            std::fill(iNeighbors + found, iNeighbors + k, numParticles);
+            std::fill(iDistSq + found, iDistSq + k, std::numeric_limits<T>::max());
+        }
+    }
+}
+
+/*! @brief find the k nearest particles of arbitrary query points
+ *
+ * @param[in]  qx,qy,qz      query point coordinates, any order
+ * @param[in]  numQueries    number of query points
+ * @param[in]  x,y,z         particle coordinates in SFC order
+ * @param[in]  numParticles  number of particles
+ * @param[in]  tree          octree connectivity, node boxes and particle layout
+ * @param[in]  box           coordinate bounding box
+ * @param[in]  k             number of neighbors per query
+ * @param[out] neighbors     k particle indices per query, sorted by distance, starting at neighbors + q * k
+ * @param[out] distSq        corresponding squared distances, same layout as @p neighbors
+ *
+ * Query points may lie outside of @p box, except in periodic dimensions.
+ * If there are fewer than k particles, the remaining entries are filled with the index @p numParticles
+ * and the distance numeric_limits<T>::max().
+ */
+template<class T, class KeyType>
+void knnPoints(const T* qx,
+               const T* qy,
+               const T* qz,
+               std::size_t numQueries,
+               const T* x,
+               const T* y,
+               const T* z,
+               LocalIndex numParticles,
+               const OctreeNsView<T, KeyType>& tree,
+               const Box<T>& box,
+               unsigned k,
+               LocalIndex* neighbors,
+               T* distSq)
+{
+#pragma omp parallel
+    {
+        KnnScratch<T> scratch;
+
+#pragma omp for schedule(dynamic, 64)
+        for (std::size_t q = 0; q < numQueries; ++q)
+        {
+            LocalIndex* qNeighbors = neighbors + q * k;
+            T*          qDistSq    = distSq + q * k;
+
+            unsigned found = knnQuery(Vec3<T>{qx[q], qy[q], qz[q]}, numParticles, k, x, y, z, tree, box, scratch,
+                                      qNeighbors, qDistSq);
+            std::fill(qNeighbors + found, qNeighbors + k, numParticles);
+            std::fill(qDistSq + found, qDistSq + k, std::numeric_limits<T>::max());
+        }
+    }
+}
+
+} // namespace cstone
@@ -0,0 +1,186 @@
+/*! @file
+ * @brief  Verlet neighbor lists: reuse neighbor lists with an extended search radius across time-steps
+ *
+ * @author Sebastian Keller <sebastian.f.keller@gmail.com>
+ *
+ * The cache stores, for each particle, the neighbors within 2h + skin at the time of the last build, together
+ * with the reference coordinates and smoothing lengths. As long as no particle has moved by more than skin / 2
+ * (and smoothing lengths have not grown correspondingly), every pair within 2h is still contained in the cached
+ * lists and the exact neighbors can be obtained by re-filtering the cached lists. This skips both the tree
+ * rebuild and the tree traversal. Particles must not be reordered between two builds.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "findneighbors.hpp"
+
+namespace cstone
+{
+
+template<class T>
+class VerletNeighborCache
+{
+public:
+    /*! @brief construct an empty cache
+     *
+     * @param skin         extension of the search radius 2h of the cached lists
+     * @param ngmaxCached  maximum number of cached neighbors per particle, has to accommodate the larger radius
+     */
+    VerletNeighborCache(T skin, unsigned ngmaxCached)
+        : skin_(skin)
+        , ngmaxCached_(ngmaxCached)
+    {
+    }
+
+    /*! @brief build the cached lists with a search radius of 2h + skin
+     *
+     * @param[in] x,y,z,h       SFC-sorted particle coordinates and smoothing lengths
+     * @param[in] numParticles  number of particles
+     * @param[in] tree          octree for the current particle coordinates
+     * @param[in] box           coordinate bounding box
+     */
+    template<class KeyType>
+    void build(const T* x,
+               const T* y,
+               const T* z,
+               const T* h,
+               LocalIndex numParticles,
+               const OctreeNsView<T, KeyType>& tree,
+               const Box<T>& box)
+    {
+        box_ = box;
+        x0_.assign(x, x + numParticles);
+        y0_.assign(y, y + numParticles);
+        z0_.assign(z, z + numParticles);
+        h0_.assign(h, h + numParticles);
+
+        // findNeighbors searches within 2h, so 2 * (h + skin / 2) gives the extended radius
+        std::vector<T> hSkin(numParticles);
+#pragma omp parallel for schedule(static)
+        for (LocalIndex i = 0; i < numParticles; ++i)
+        {
+            hSkin[i] = h[i] + skin_ / 2;
+        }
+
+        neighbors_.resize(size_t(numParticles) * ngmaxCached_);
+        counts_.resize(numParticles);
+
+        unsigned maxCount = 0;
+#pragma omp parallel for schedule(static) reduction(max : maxCount)
+        for (LocalIndex i = 0; i < numParticles; ++i)
+        {
+            unsigned count = findNeighbors(i, x, y, z, hSkin.data(), tree, box, ngmaxCached_,
+                                           neighbors_.data() + size_t(i) * ngmaxCached_);
+            counts_[i]     = std::min(count, ngmaxCached_);
+            maxCount       = std::max(maxCount, count);
+        }
+        overflow_ = maxCount > ngmaxCached_;
+    }
+
+    //! @brief largest (minimum image) distance of any particle to its position at the time of the last build
+    T maxDisplacement(const T* x, const T* y, const T* z) const
+    {
+        LocalIndex numParticles = x0_.size();
+        Vec3<T>    period       = periodLengths(box_);
+
+        T maxDispSq = 0;
+#pragma omp parallel for schedule(static) reduction(max : maxDispSq)
+        for (LocalIndex i = 0; i < numParticles; ++i)
+        {
+            T dx      = minImage(x[i] - x0_[i], period[0]);
+            T dy      = minImage(y[i] - y0_[i], period[1]);
+            T dz      = minImage(z[i] - z0_[i], period[2]);
+            maxDispSq = std::max(maxDispSq, dx * dx + dy * dy + dz * dz);
+        }
+        return std::sqrt(maxDispSq);
+    }
+
+    /*! @brief check whether the cached lists still contain all neighbors within 2h of each particle
+     *
+     * @param[in] x,y,z,h  current particle coordinates and smoothing lengths, same order as in the last build
+     *
+     * Two particles i and j within 2h_i now were at most 2h_i + 2 * maxDisplacement apart at the last build.
+     * The lists are therefore complete if 2h_i + 2 * maxDisplacement <= 2h0_i + skin for all particles,
+     * which reduces to maxDisplacement <= skin / 2 for constant smoothing lengths.
+     */
+    bool isValid(const T* x, const T* y, const T* z, const T* h) const
+    {
+        if (x0_.empty() || overflow_) { return false; }
+
+        LocalIndex numParticles = x0_.size();
+        T          maxDisp      = maxDisplacement(x, y, z);
+
+        int numInvalid = 0;
+#pragma omp parallel for schedule(static) reduction(+ : numInvalid)
+        for (LocalIndex i = 0; i < numParticles; ++i)
+        {
+            numInvalid += (h[i] + maxDisp > h0_[i] + skin_ / 2);
+        }
+        return numInvalid == 0;
+    }
+
+    /*! @brief extract the neighbors within 2h from the cached lists
+     *
+     * @param[in]  x,y,z,h    current particle coordinates and smoothing lengths, same order as in the last build
+     * @param[in]  ngmax      maximum number of neighbors per particle
+     * @param[out] neighbors  neighbor indices, @p ngmax per particle, same layout as findNeighbors
+     * @param[out] counts     neighbor count per particle, can exceed @p ngmax like in findNeighbors
+     *
+     * The result is exact only if isValid() returns true for the same coordinates and smoothing lengths.
+     */
+    void filter(const T* x, const T* y, const T* z, const T* h, unsigned ngmax, LocalIndex* neighbors,
+                unsigned* counts) const
+    {
+        LocalIndex numParticles = x0_.size();
+        Vec3<T>    period       = periodLengths(box_);
+
+#pragma omp parallel for schedule(static)
+        for (LocalIndex i = 0; i < numParticles; ++i)
+        {
+            Vec3<T>           target{x[i], y[i], z[i]};
+            T                 radiusSq     = T(4) * h[i] * h[i];
+            const LocalIndex* cached       = neighbors_.data() + size_t(i) * ngmaxCached_;
+            LocalIndex*       iNeighbors   = neighbors + size_t(i) * ngmax;
+            unsigned          numNeighbors = 0;
+
+            for (unsigned k = 0; k < counts_[i]; ++k)
+            {
+                LocalIndex j  = cached[k];
+                T          dx = minImage(x[j] - target[0], period[0]);
+                T          dy = minImage(y[j] - target[1], period[1]);
+                T          dz = minImage(z[j] - target[2], period[2]);
+                if (dx * dx + dy * dy + dz * dz < radiusSq)
+                {
+                    if (numNeighbors < ngmax) { iNeighbors[numNeighbors] = j; }
+                    numNeighbors++;
+                }
+            }
+            counts[i] = numNeighbors;
+        }
+    }
+
+    //! @brief true if any particle had more than ngmaxCached neighbors in the last build
+    bool overflow() const { return overflow_; }
+
+    T        skin() const { return skin_; }
+    unsigned ngmaxCached() const { return ngmaxCached_; }
+
+private:
+    T        skin_;
+    unsigned ngmaxCached_;
+    bool     overflow_{false};
+    Box<T>   box_{0, 1};
+
+    //! @brief coordinates and smoothing lengths at the time of the last build
+    std::vector<T> x0_, y0_, z0_, h0_;
+
+    //! @brief cached neighbors within 2h0 + skin, ngmaxCached_ per particle
+    std::vector<LocalIndex> neighbors_;
+    std::vector<unsigned>   counts_;
+};
+
+} // namespace cstone
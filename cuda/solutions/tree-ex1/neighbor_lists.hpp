@@ -0,0 +1,254 @@
+/*! @file
+ * @brief  Compact neighbor list formats: CSR and delta + varint compressed CSR
+ *
+ * @author Sebastian Keller <sebastian.f.keller@gmail.com>
+ *
+ * findNeighbors writes ngmax slots per particle, regardless of the actual neighbor count. The formats in this file
+ * store exactly as many entries as there are neighbors. Because particles are SFC-sorted, the neighbors of a
+ * particle have indices close to its own and to each other. The compressed format exploits this by storing the
+ * sorted neighbor indices as differences to their predecessor in a variable length (LEB128) byte encoding,
+ * such that most neighbors occupy a single byte.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "util/primitives.hpp"
+#include "findneighbors.hpp"
+
+namespace cstone
+{
+
+namespace detail
+{
+
+//! @brief number of bytes needed to store @p value as a varint
+HOST_DEVICE_FUN inline unsigned varintSize(uint64_t value)
+{
+    unsigned numBytes = 1;
+    while (value >= 0x80)
+    {
+        value >>= 7;
+        numBytes++;
+    }
+    return numBytes;
+}
+
+//! @brief write @p value as little-endian base-128 varint, return the position after the last written byte
+HOST_DEVICE_FUN inline uint8_t* writeVarint(uint64_t value, uint8_t* out)
+{
+    while (value >= 0x80)
+    {
+        *out++ = uint8_t(value) | 0x80;
+        value >>= 7;
+    }
+    *out++ = uint8_t(value);
+    return out;
+}
+
+//! @brief read a varint into @p value, return the position after the last read byte
+HOST_DEVICE_FUN inline const uint8_t* readVarint(const uint8_t* in, uint64_t& value)
+{
+    value     = 0;
+    int shift = 0;
+    uint8_t byte;
+    do
+    {
+        byte = *in++;
+        value |= uint64_t(byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return in;
+}
+
+//! @brief map signed to unsigned integers such that small magnitudes stay small: 0, -1, 1, -2, ... -> 0, 1, 2, 3, ...
+HOST_DEVICE_FUN inline uint64_t zigzagEncode(int64_t value) { return (uint64_t(value) << 1) ^ uint64_t(value >> 63); }
+
+HOST_DEVICE_FUN inline int64_t zigzagDecode(uint64_t value) { return int64_t(value >> 1) ^ -int64_t(value & 1); }
+
+} // namespace detail
+
+//! @brief neighbor lists in compressed sparse row format
+struct NeighborListsCsr
+{
+    //! @brief neighbors of particle i are stored in indices[offsets[i]:offsets[i+1]], length numParticles + 1
+    std::vector<std::size_t> offsets;
+    std::vector<LocalIndex>  indices;
+
+    LocalIndex numParticles() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+};
+
+/*! @brief forward iterator decoding the compressed neighbor list of one particle
+ *
+ * The first neighbor is stored as the zigzag-encoded signed difference to the index of the particle itself,
+ * each following neighbor as the (positive) difference to its predecessor.
+ */
+class CompressedNeighborIterator
+{
+public:
+    //! @brief iterator to the first neighbor of particle @p i, encoded in [pos:end]
+    HOST_DEVICE_FUN CompressedNeighborIterator(const uint8_t* pos, const uint8_t* end, LocalIndex i)
+        : pos_(pos)
+        , end_(end)
+    {
+        if (pos_ != end_)
+        {
+            uint64_t delta;
+            next_  = detail::readVarint(pos_, delta);
+            value_ = LocalIndex(int64_t(i) + detail::zigzagDecode(delta));
+        }
+    }
+
+    //! @brief past-the-end iterator
+    HOST_DEVICE_FUN explicit CompressedNeighborIterator(const uint8_t* end)
+        : pos_(end)
+        , end_(end)
+    {
+    }
+
+    HOST_DEVICE_FUN LocalIndex operator*() const { return value_; }
+
+    HOST_DEVICE_FUN CompressedNeighborIterator& operator++()
+    {
+        pos_ = next_;
+        if (pos_ != end_)
+        {
+            uint64_t delta;
+            next_ = detail::readVarint(pos_, delta);
+            value_ += LocalIndex(delta);
+        }
+        return *this;
+    }
+
+    HOST_DEVICE_FUN bool operator==(const CompressedNeighborIterator& other) const { return pos_ == other.pos_; }
+    HOST_DEVICE_FUN bool operator!=(const CompressedNeighborIterator& other) const { return pos_ != other.pos_; }
+
+private:
+    const uint8_t* pos_;
+    const uint8_t* end_;
+    const uint8_t* next_{nullptr};
+    LocalIndex     value_{0};
+};
+
+//! @brief the compressed neighbors of a single particle, usable in range-based for loops
+class CompressedNeighborRange
+{
+public:
+    HOST_DEVICE_FUN CompressedNeighborRange(const uint8_t* first, const uint8_t* last, LocalIndex i)
+        : first_(first)
+        , last_(last)
+        , i_(i)
+    {
+    }
+
+    HOST_DEVICE_FUN CompressedNeighborIterator begin() const { return {first_, last_, i_}; }
+    HOST_DEVICE_FUN CompressedNeighborIterator end() const { return CompressedNeighborIterator(last_); }
+
+private:
+    const uint8_t* first_;
+    const uint8_t* last_;
+    LocalIndex     i_;
+};
+
+//! @brief neighbor lists in CSR format with delta + varint encoded indices
+struct CompressedNeighborLists
+{
+    //! @brief the neighbors of particle i are encoded in bytes[offsets[i]:offsets[i+1]], length numParticles + 1
+    std::vector<std::size_t> offsets;
+    std::vector<uint8_t>     bytes;
+
+    LocalIndex numParticles() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+
+    CompressedNeighborRange neighbors(LocalIndex i) const
+    {
+        return {bytes.data() + offsets[i], bytes.data() + offsets[i + 1], i};
+    }
+};
+
+/*! @brief convert neighbor lists with a fixed number of slots per particle into sorted CSR lists
+ *
+ * @param[in]  neighbors     neighbor indices, @p ngmax per particle, as computed by findNeighbors
+ * @param[in]  counts        neighbor count per particle, counts above @p ngmax are clamped
+ * @param[in]  numParticles  number of particles
+ * @param[in]  ngmax         number of neighbor slots per particle in @p neighbors
+ * @param[out] csr           output CSR lists, the neighbors of each particle are sorted in ascending order
+ */
+inline void denseToCsr(const LocalIndex* neighbors, const unsigned* counts, LocalIndex numParticles, unsigned ngmax,
+                       NeighborListsCsr& csr)
+{
+    std::vector<unsigned> storedCounts(numParticles);
+#pragma omp parallel for schedule(static)
+    for (LocalIndex i = 0; i < numParticles; ++i)
+    {
+        storedCounts[i] = std::min(counts[i], ngmax);
+    }
+
+    csr.offsets.resize(numParticles + 1);
+    csr.offsets[numParticles] = exclusiveScan(storedCounts.data(), csr.offsets.data(), numParticles, std::size_t(0));
+    csr.indices.resize(csr.offsets[numParticles]);
+
+#pragma omp parallel for schedule(static)
+    for (LocalIndex i = 0; i < numParticles; ++i)
+    {
+        const LocalIndex* src = neighbors + std::size_t(i) * ngmax;
+        LocalIndex*       dst = csr.indices.data() + csr.offsets[i];
+        std::copy(src, src + storedCounts[i], dst);
+        std::sort(dst, dst + storedCounts[i]);
+    }
+}
+
+/*! @brief compress sorted CSR neighbor lists
+ *
+ * @param[in]  csr         input neighbor lists, the neighbors of each particle must be sorted and unique
+ * @param[out] compressed  output lists, decode the neighbors of particle i by iterating over compressed.neighbors(i)
+ */
+inline void compressNeighbors(const NeighborListsCsr& csr, CompressedNeighborLists& compressed)
+{
+    LocalIndex numParticles = csr.numParticles();
+
+    auto encodedSize = [&csr](LocalIndex i)
+    {
+        std::size_t first = csr.offsets[i];
+        std::size_t last  = csr.offsets[i + 1];
+        if (first == last) { return std::size_t(0); }
+
+        std::size_t numBytes = detail::varintSize(detail::zigzagEncode(int64_t(csr.indices[first]) - int64_t(i)));
+        for (std::size_t k = first + 1; k < last; ++k)
+        {
+            numBytes += detail::varintSize(csr.indices[k] - csr.indices[k - 1]);
+        }
+        return numBytes;
+    };
+
+    std::vector<std::size_t> numBytes(numParticles);
+#pragma omp parallel for schedule(static)
+    for (LocalIndex i = 0; i < numParticles; ++i)
+    {
+        numBytes[i] = encodedSize(i);
+    }
+
+    compressed.offsets.resize(numParticles + 1);
+    compressed.offsets[numParticles] =
+        exclusiveScan(numBytes.data(), compressed.offsets.data(), numParticles, std::size_t(0));
+    compressed.bytes.resize(compressed.offsets[numParticles]);
+
+#pragma omp parallel for schedule(static)
+    for (LocalIndex i = 0; i < numParticles; ++i)
+    {
+        std::size_t first = csr.offsets[i];
+        std::size_t last  = csr.offsets[i + 1];
+        if (first == last) { continue; }
+
+        uint8_t* out = compressed.bytes.data() + compressed.offsets[i];
+        out          = detail::writeVarint(detail::zigzagEncode(int64_t(csr.indices[first]) - int64_t(i)), out);
+        for (std::size_t k = first + 1; k < last; ++k)
+        {
+            out = detail::writeVarint(csr.indices[k] - csr.indices[k - 1], out);
+        }
+    }
+}
+
+} // namespace cstone
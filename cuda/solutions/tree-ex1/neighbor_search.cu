@@ -4,15 +4,33 @@
  * @author Sebastian Keller <sebastian.f.keller@gmail.com>
  */
 
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
 #include <thrust/device_vector.h>
 
 #include "util/cuda_utils.hpp"
+#include "util/particle_io.hpp"
 #include "util/random.hpp"
 #include "util/timing.cuh"
 
+#include "tree/octree_io.hpp"
+#include "tree/octree_manager.hpp"
 #include "findneighbors.hpp"
+#include "findneighbors_groups.hpp"
 #include "findneighbors_warps.cuh"
+#include "knn.hpp"
+#include "neighbor_cache.hpp"
+#include "neighbor_lists.hpp"
+#include "range_query.hpp"
+#include "smoothing_length.hpp"
 
 // uncomment to enable warp-level optimized neighbor search
 // #define USE_WARPS
@@ -31,36 +49,65 @@ __global__ void findNeighborsKernel(const T* x, const T* y, const T* z, const T*
 }
 
 template<class T, class KeyType>
-void benchmarkGpu(int numParticles, bool verbose)
+void benchmarkGpu(int numParticles,
+                  ParticleDistribution distribution,
+                  BoundaryType boundary,
+                  const std::string& snapshotFile,
+                  bool verbose)
 {
-    Box<T> box{0, 1, BoundaryType::open};
+    // snapshots bring their own box
+    Box<T> box{0, 1, boundary};
     int    maxNeighbors = 200;
 
     /****** Particle data and tree generation ****************/
-    RandomCoordinates<T, KeyType> coords(numParticles, box);
-    std::vector<T>                h(numParticles, 0.012);
+    std::vector<T>       xData, yData, zData, h;
+    std::vector<KeyType> keyData;
 
-    const T*       x    = coords.x().data();
-    const T*       y    = coords.y().data();
-    const T*       z    = coords.z().data();
-    const KeyType* keys = coords.keys().data();
+    if (snapshotFile.empty())
+    {
+        RandomCoordinates<T, KeyType> coords(numParticles, box, distribution);
+        xData   = coords.x();
+        yData   = coords.y();
+        zData   = coords.z();
+        keyData = coords.keys();
+    }
+    else
+    {
+        float loadTime = timeCpu([&]() { box = readParticleSnapshot(snapshotFile, xData, yData, zData, h, keyData); });
+        numParticles   = xData.size();
+        std::cout << "loaded " << numParticles << " particles from " << snapshotFile << " in " << loadTime << " s"
+                  << std::endl;
+    }
+    // use the smoothing lengths from the snapshot if present
+    bool adaptInitialH = h.empty() && (distribution != ParticleDistribution::uniform || !snapshotFile.empty());
+    if (h.empty()) { h.assign(numParticles, 0.012); }
+
+    const T*       x    = xData.data();
+    const T*       y    = yData.data();
+    const T*       z    = zData.data();
+    const KeyType* keys = keyData.data();
 
-    unsigned bucketSize   = 64; // maximum number of particles per leaf node
-    auto [csTree, counts] = computeOctree(keys, keys + numParticles, bucketSize);
-    OctreeData<KeyType, CpuTag> octree;
-    octree.resize(nNodes(csTree));
-    buildLinkedTree<KeyType>(csTree.data(), octree.data());
-    const TreeNodeIndex* childOffsets = octree.childOffsets.data();
-    const TreeNodeIndex* toLeafOrder  = octree.internalToLeaf.data();
+    unsigned bucketSize = 64; // maximum number of particles per leaf node
+    OctreeManager<T, KeyType> tree(bucketSize);
+    tree.update(keys, keys + numParticles, box);
+    // prune the traversal with the particle extent of each node instead of its geometric box
+    tree.updateTightBoxes(x, y, z);
 
-    std::vector<LocalIndex> layout(nNodes(csTree) + 1);
-    std::exclusive_scan(counts.begin(), counts.end() + 1, layout.begin(), 0);
+    const auto& octree      = tree.linkedTree();
+    const auto& layout      = tree.layout();
+    const auto& nodeCenters = tree.tightCenters();
+    const auto& nodeSizes   = tree.tightSizes();
 
-    std::vector<Vec3<T>> nodeCenters(octree.numNodes), nodeSizes(octree.numNodes);
-    nodeFpCenters(octree.prefixes.data(), octree.numNodes, nodeCenters.data(), nodeSizes.data(), box);
+    OctreeNsView<T, KeyType> treeView = tree.tightNsView();
 
-    OctreeNsView<T, KeyType> treeView{nodeCenters.data(), nodeSizes.data(), octree.childOffsets.data(),
-                                      octree.internalToLeaf.data(), layout.data()};
+    if (adaptInitialH)
+    {
+        // with non-uniform particles, a global h yields zero neighbors in voids and overflows in clusters
+        std::vector<LocalIndex> neighborsScratch(maxNeighbors * numParticles);
+        std::vector<unsigned>   neighborsCountScratch(numParticles);
+        adaptSmoothingLengths(x, y, z, h.data(), numParticles, treeView, box, 100u, 10u, 30, maxNeighbors,
+                              neighborsScratch.data(), neighborsCountScratch.data());
+    }
 
     /****** CPU output data ****************/
     std::vector<LocalIndex> neighborsCPU(maxNeighbors * numParticles);
@@ -85,22 +132,421 @@ void benchmarkGpu(int numParticles, bool verbose)
         std::cout << std::endl;
     }
 
+    /****** CPU group traversal ****************/
+    std::vector<LocalIndex> neighborsGroups(maxNeighbors * numParticles);
+    std::vector<unsigned>   neighborsCountGroups(numParticles);
+
+    auto findNeighborsCpuGroups = [&]()
+    {
+        findNeighborsGroups(x, y, z, h.data(), numParticles, treeView, box, maxNeighbors, neighborsGroups.data(),
+                            neighborsCountGroups.data());
+    };
+
+    float cpuGroupTime = timeCpu(findNeighborsCpuGroups);
+    bool  groupsPass   = std::equal(neighborsCountGroups.begin(), neighborsCountGroups.end(), neighborsCountCPU.begin());
+    std::cout << "CPU group traversal time " << cpuGroupTime << " s, counts " << (groupsPass ? "PASS" : "FAIL")
+              << std::endl;
+
+    /****** CPU traversal of packed node records ****************/
+    tree.updatePackedNodes(true);
+    const PackedNode* packedNodes = tree.packedNodes().data();
+
+    std::vector<LocalIndex> neighborsPacked(maxNeighbors * numParticles);
+    std::vector<unsigned>   neighborsCountPacked(numParticles);
+
+    auto findNeighborsCpuPacked = [&]()
+    {
+#pragma omp parallel for
+        for (LocalIndex i = 0; i < numParticles; ++i)
+        {
+            neighborsCountPacked[i] = findNeighbors(i, x, y, z, h.data(), packedNodes, box, maxNeighbors,
+                                                    neighborsPacked.data() + i * maxNeighbors);
+        }
+    };
+
+    float cpuPackedTime = timeCpu(findNeighborsCpuPacked);
+    bool  packedPass = std::equal(neighborsCountPacked.begin(), neighborsCountPacked.end(), neighborsCountCPU.begin());
+    // same traversal order as findNeighbors on treeView, such that the lists must match entry by entry
+    for (LocalIndex i = 0; i < numParticles && packedPass; ++i)
+    {
+        auto listStart = i * maxNeighbors;
+        auto listEnd   = listStart + std::min(neighborsCountCPU[i], unsigned(maxNeighbors));
+        packedPass     = std::equal(neighborsPacked.begin() + listStart, neighborsPacked.begin() + listEnd,
+                                    neighborsCPU.begin() + listStart);
+    }
+    std::cout << "CPU packed node traversal time " << cpuPackedTime << " s, lists " << (packedPass ? "PASS" : "FAIL")
+              << std::endl;
+
+    /****** CPU Verlet list cache ****************/
+    // lists with a skin of 10% of the search radius can be reused until a particle has moved by 5% of 2h
+    T                      skin = T(0.2) * *std::min_element(h.begin(), h.end());
+    VerletNeighborCache<T> cache(skin, maxNeighbors + maxNeighbors / 2);
+
+    float cacheBuildTime = timeCpu([&]() { cache.build(x, y, z, h.data(), numParticles, treeView, box); });
+
+    std::vector<LocalIndex> neighborsCached(maxNeighbors * numParticles);
+    std::vector<unsigned>   neighborsCountCached(numParticles);
+
+    auto filterCachedNeighbors = [&]()
+    { cache.filter(x, y, z, h.data(), maxNeighbors, neighborsCached.data(), neighborsCountCached.data()); };
+
+    float cacheFilterTime = timeCpu(filterCachedNeighbors);
+    bool  cachePass = std::equal(neighborsCountCached.begin(), neighborsCountCached.end(), neighborsCountCPU.begin());
+    std::cout << "CPU Verlet cache build time " << cacheBuildTime << " s, filter time " << cacheFilterTime
+              << " s, counts " << (cachePass ? "PASS" : "FAIL") << std::endl;
+
+    {
+        // move every particle by 0.45 skin in a random direction, wrapping around periodic boundaries
+        std::vector<T> xMoved(numParticles), yMoved(numParticles), zMoved(numParticles);
+        std::mt19937                gen(42);
+        std::normal_distribution<T> direction(0, 1);
+
+        Vec3<T> boxMin{box.xmin(), box.ymin(), box.zmin()};
+        Vec3<T> period = periodLengths(box);
+        auto    wrap   = [](T v, T lo, T length)
+        { return length > 0 ? v - length * std::floor((v - lo) / length) : v; };
+        for (LocalIndex i = 0; i < numParticles; ++i)
+        {
+            Vec3<T> d{direction(gen), direction(gen), direction(gen)};
+            d *= T(0.45) * skin / std::sqrt(norm2(d));
+            xMoved[i] = wrap(x[i] + d[0], boxMin[0], period[0]);
+            yMoved[i] = wrap(y[i] + d[1], boxMin[1], period[1]);
+            zMoved[i] = wrap(z[i] + d[2], boxMin[2], period[2]);
+        }
+
+        // reference search on the unchanged tree, pruned with the bounding boxes of the moved particles
+        OctreeManager<T, KeyType> movedTree(bucketSize);
+        movedTree.update(keys, keys + numParticles, box);
+        movedTree.updateTightBoxes(xMoved.data(), yMoved.data(), zMoved.data());
+        OctreeNsView<T, KeyType> movedView = movedTree.tightNsView();
+
+        std::vector<LocalIndex> neighborsMoved(maxNeighbors * numParticles);
+        std::vector<LocalIndex> neighborsMovedRef(maxNeighbors * numParticles);
+        std::vector<unsigned>   neighborsCountMoved(numParticles);
+        std::vector<unsigned>   neighborsCountMovedRef(numParticles);
+
+        bool reusePass = cache.isValid(xMoved.data(), yMoved.data(), zMoved.data(), h.data());
+        cache.filter(xMoved.data(), yMoved.data(), zMoved.data(), h.data(), maxNeighbors, neighborsMoved.data(),
+                     neighborsCountMoved.data());
+
+#pragma omp parallel for
+        for (LocalIndex i = 0; i < numParticles; ++i)
+        {
+            neighborsCountMovedRef[i] = findNeighbors(i, xMoved.data(), yMoved.data(), zMoved.data(), h.data(),
+                                                      movedView, box, maxNeighbors,
+                                                      neighborsMovedRef.data() + i * maxNeighbors);
+        }
+
+        // the cached lists are in a different order, compare the neighbor sets of all complete lists
+        for (LocalIndex i = 0; i < numParticles; ++i)
+        {
+            reusePass &= neighborsCountMoved[i] == neighborsCountMovedRef[i];
+            if (neighborsCountMoved[i] > unsigned(maxNeighbors)) { continue; }
+
+            auto moved    = neighborsMoved.begin() + i * maxNeighbors;
+            auto movedRef = neighborsMovedRef.begin() + i * maxNeighbors;
+            std::sort(moved, moved + neighborsCountMoved[i]);
+            std::sort(movedRef, movedRef + neighborsCountMovedRef[i]);
+            reusePass &= std::equal(moved, moved + neighborsCountMoved[i], movedRef);
+        }
+
+        // a single particle moving by more than skin / 2, or a single h growing by more than that, requires a rebuild
+        xMoved[0] = wrap(x[0] + T(0.6) * skin, boxMin[0], period[0]);
+        std::vector<T> hGrown = h;
+        hGrown[0] += T(0.6) * skin;
+        bool invalidatePass = !cache.isValid(xMoved.data(), yMoved.data(), zMoved.data(), h.data()) &&
+                              !cache.isValid(x, y, z, hGrown.data());
+
+        std::cout << "CPU Verlet cache after moving particles by 0.45 skin: reuse " << (reusePass ? "PASS" : "FAIL")
+                  << ", invalidation " << (invalidatePass ? "PASS" : "FAIL") << std::endl;
+    }
+
+    /****** Compact neighbor list formats ****************/
+    NeighborListsCsr        neighborsCsr;
+    CompressedNeighborLists neighborsCompressed;
+    denseToCsr(neighborsCPU.data(), neighborsCountCPU.data(), numParticles, maxNeighbors, neighborsCsr);
+    compressNeighbors(neighborsCsr, neighborsCompressed);
+
+    bool compressedPass = true;
+    for (LocalIndex i = 0; i < numParticles; ++i)
+    {
+        auto csrNeighbor = neighborsCsr.indices.begin() + neighborsCsr.offsets[i];
+        for (LocalIndex j : neighborsCompressed.neighbors(i))
+        {
+            compressedPass &= (j == *csrNeighbor++);
+        }
+        compressedPass &= (csrNeighbor == neighborsCsr.indices.begin() + neighborsCsr.offsets[i + 1]);
+    }
+
+    double denseBytes = double(maxNeighbors) * sizeof(LocalIndex);
+    double csrBytes   = double(neighborsCsr.indices.size() * sizeof(LocalIndex) +
+                             neighborsCsr.offsets.size() * sizeof(std::size_t)) / numParticles;
+    double compressedBytes =
+        double(neighborsCompressed.bytes.size() + neighborsCompressed.offsets.size() * sizeof(std::size_t)) /
+        numParticles;
+    std::cout << "neighbor list bytes per particle: dense " << denseBytes << ", CSR " << csrBytes << ", compressed "
+              << compressedBytes << ", decoding " << (compressedPass ? "PASS" : "FAIL") << std::endl;
+
+    // two-phase search: count, scan, fill into exactly sized CSR lists without truncation
+    NeighborListsCsr neighborsTwoPhase;
+    auto findNeighborsTwoPhase = [&]()
+    { findNeighborsCsr(x, y, z, h.data(), numParticles, treeView, box, neighborsTwoPhase); };
+
+    float twoPhaseTime = timeCpu(findNeighborsTwoPhase);
+    bool twoPhasePass =
+        neighborsTwoPhase.offsets == neighborsCsr.offsets && neighborsTwoPhase.indices == neighborsCsr.indices;
+    std::cout << "CPU two-phase CSR search time " << twoPhaseTime << " s, lists " << (twoPhasePass ? "PASS" : "FAIL")
+              << std::endl;
+
     /****** Verification: compare against all-2-all ****************/
-    bool all2allpass = true;
+    // with minimum image distances in periodic dimensions of the box
+    bool                  all2allpass = true;
+    std::vector<unsigned> neighborsCountRef;
     if (numParticles <= 10000)
     {
-        std::vector<unsigned> neighborsCountRef(numParticles);
-        findNeighborsAll2All(x, y, z, h.data(), numParticles, neighborsCountRef.data());
+        neighborsCountRef.resize(numParticles);
+        findNeighborsAll2All(x, y, z, h.data(), numParticles, neighborsCountRef.data(), box);
 
         all2allpass = std::equal(neighborsCountCPU.begin(), neighborsCountCPU.end(), neighborsCountRef.begin());
-        std::cout << "CPU all-2-all reference: " << (all2allpass ? "PASS" : "FAIL") << std::endl;
+        for (LocalIndex i = 0; i < numParticles; ++i)
+        {
+            all2allpass &= neighborsTwoPhase.offsets[i + 1] - neighborsTwoPhase.offsets[i] == neighborsCountRef[i];
+        }
+        std::cout << "CPU all-2-all reference, " << (box.boundaryX() == BoundaryType::periodic ? "periodic" : "open")
+                  << " box, fixed-size and CSR lists: " << (all2allpass ? "PASS" : "FAIL") << std::endl;
     }
     else { std::cout << "CPU all-2-all reference: SKIPPED (numParticles > 10000)" << std::endl; }
 
+    /****** CPU k-nearest neighbors ****************/
+    {
+        unsigned                k = 32;
+        std::vector<LocalIndex> knnNeighbors(std::size_t(k) * numParticles);
+        std::vector<T>          knnDistSq(std::size_t(k) * numParticles);
+
+        auto findKnn = [&]()
+        { knnParticles(x, y, z, numParticles, treeView, box, k, knnNeighbors.data(), knnDistSq.data()); };
+
+        float knnTime = timeCpu(findKnn);
+
+        // the fixed-radius neighbors of a particle with fewer than k of them must be its nearest particles
+        bool knnPass = true;
+        for (LocalIndex i = 0; i < numParticles; ++i)
+        {
+            unsigned count    = neighborsCountCPU[i];
+            T        radiusSq = T(4) * h[i] * h[i];
+            if (count >= k) { continue; }
+            if (count > 0) { knnPass &= knnDistSq[std::size_t(i) * k + count - 1] < radiusSq; }
+            knnPass &= knnDistSq[std::size_t(i) * k + count] >= radiusSq;
+        }
+        std::cout << "CPU " << k << "-nearest neighbors time " << knnTime << " s, consistency with radius search "
+                  << (knnPass ? "PASS" : "FAIL") << std::endl;
+
+        // arbitrary query points, on a line through the box that extends beyond it in open dimensions
+        std::size_t    numQueries = 16;
+        std::vector<T> qx(numQueries), qy(numQueries), qz(numQueries);
+        Vec3<T>        boxMin{box.xmin(), box.ymin(), box.zmin()};
+        Vec3<T>        boxLen{box.lx(), box.ly(), box.lz()};
+        Vec3<T>        period = periodLengths(box);
+        for (std::size_t q = 0; q < numQueries; ++q)
+        {
+            T       t = T(-0.25) + T(1.5) * q / (numQueries - 1);
+            Vec3<T> u{t, T(0.3) + T(0.5) * t, T(0.9) - T(0.6) * t};
+            for (int d = 0; d < 3; ++d)
+            {
+                // periodic dimensions only accept query points inside the box
+                if (period[d] > 0) { u[d] -= std::floor(u[d]); }
+            }
+            qx[q] = boxMin[0] + u[0] * boxLen[0];
+            qy[q] = boxMin[1] + u[1] * boxLen[1];
+            qz[q] = boxMin[2] + u[2] * boxLen[2];
+        }
+
+        std::vector<LocalIndex> knnQueryNeighbors(numQueries * k);
+        std::vector<T>          knnQueryDistSq(numQueries * k);
+        knnPoints(qx.data(), qy.data(), qz.data(), numQueries, x, y, z, numParticles, treeView, box, k,
+                  knnQueryNeighbors.data(), knnQueryDistSq.data());
+
+        // brute force reference over all particles with minimum image distances, padded like knnPoints
+        bool                                  knnPointsPass = true;
+        std::vector<std::pair<T, LocalIndex>> candidates(numParticles);
+        for (std::size_t q = 0; q < numQueries; ++q)
+        {
+            for (LocalIndex j = 0; j < numParticles; ++j)
+            {
+                T dx          = minImage(x[j] - qx[q], period[0]);
+                T dy          = minImage(y[j] - qy[q], period[1]);
+                T dz          = minImage(z[j] - qz[q], period[2]);
+                candidates[j] = {dx * dx + dy * dy + dz * dz, j};
+            }
+            unsigned numFound = std::min(k, unsigned(numParticles));
+            std::partial_sort(candidates.begin(), candidates.begin() + numFound, candidates.end());
+            candidates.resize(k, {std::numeric_limits<T>::max(), LocalIndex(numParticles)});
+            for (unsigned n = 0; n < k; ++n)
+            {
+                knnPointsPass &= knnQueryDistSq[q * k + n] == candidates[n].first &&
+                                 knnQueryNeighbors[q * k + n] == candidates[n].second;
+            }
+            candidates.resize(numParticles);
+        }
+        std::cout << "CPU " << k << "-nearest neighbors of " << numQueries << " query points, brute force reference "
+                  << (knnPointsPass ? "PASS" : "FAIL") << std::endl;
+    }
+
+    /****** CPU range queries ****************/
+    {
+        // every particle must be covered by exactly one range if it lies inside the region, and by none otherwise
+        auto checkRanges = [&](const auto& region, const std::vector<ParticleRange>& ranges)
+        {
+            std::vector<int> coverage(numParticles, 0);
+            for (const auto& r : ranges)
+            {
+                for (LocalIndex j = r.first; j < r.second; ++j)
+                {
+                    coverage[j]++;
+                }
+            }
+            bool pass = true;
+            for (LocalIndex j = 0; j < numParticles; ++j)
+            {
+                pass &= coverage[j] == int(region.containsPoint(Vec3<T>{x[j], y[j], z[j]}));
+            }
+            return pass;
+        };
+
+        auto printQuery = [](const char* name, const std::vector<ParticleRange>& ranges, float time, bool pass)
+        {
+            std::size_t numFound = 0;
+            for (const auto& r : ranges)
+            {
+                numFound += r.second - r.first;
+            }
+            std::cout << "CPU " << name << " range query time " << time << " s, " << numFound << " particles in "
+                      << ranges.size() << " ranges, " << (pass ? "PASS" : "FAIL") << std::endl;
+        };
+
+        Vec3<T> boxMin{box.xmin(), box.ymin(), box.zmin()};
+        Vec3<T> boxLen{box.lx(), box.ly(), box.lz()};
+
+        AabbRegion<T> aabb{boxMin + Vec3<T>{T(0.2) * boxLen[0], T(0.3) * boxLen[1], T(0.25) * boxLen[2]},
+                           boxMin + Vec3<T>{T(0.6) * boxLen[0], T(0.7) * boxLen[1], T(0.5) * boxLen[2]}};
+
+        std::vector<ParticleRange> aabbRanges;
+        float aabbTime = timeCpu([&]() { aabbRanges = rangeQuery(aabb, x, y, z, treeView); });
+        printQuery("AABB", aabbRanges, aabbTime, checkRanges(aabb, aabbRanges));
+
+        // camera in front of the x-min face, looking into the box along +x
+        Vec3<T> eye     = boxMin + Vec3<T>{T(-0.5) * boxLen[0], T(0.5) * boxLen[1], T(0.5) * boxLen[2]};
+        T       nearX   = T(0.7) * boxLen[0];
+        T       farX    = T(1.2) * boxLen[0];
+        auto    frustum = makeFrustum(eye, Vec3<T>{1, 0, 0}, Vec3<T>{0, 0, 1}, T(0.6), T(1.5), nearX, farX);
+
+        std::vector<ParticleRange> frustumRanges;
+        float frustumTime = timeCpu([&]() { frustumRanges = rangeQuery(frustum, x, y, z, treeView); });
+        printQuery("frustum", frustumRanges, frustumTime, checkRanges(frustum, frustumRanges));
+    }
+
+    /****** CPU smoothing length iteration ****************/
+    {
+        std::vector<T>          hAdapted = h;
+        std::vector<LocalIndex> neighborsAdapted(maxNeighbors * numParticles);
+        std::vector<unsigned>   neighborsCountAdapted(numParticles);
+
+        unsigned        ngTarget = 100, ngTolerance = 5;
+        HIterationStats hStats;
+
+        auto adaptH = [&]()
+        {
+            hStats = adaptSmoothingLengths(x, y, z, hAdapted.data(), numParticles, treeView, box, ngTarget, ngTolerance,
+                                           10, maxNeighbors, neighborsAdapted.data(), neighborsCountAdapted.data());
+        };
+
+        float hTime = timeCpu(adaptH);
+        std::cout << "CPU h-iteration to " << ngTarget << " +- " << ngTolerance << " neighbors: " << hTime << " s, "
+                  << hStats.numRounds << " rounds, " << double(hStats.numSearches) / numParticles
+                  << " searches per particle, " << hStats.numUnconverged << " unconverged" << std::endl;
+    }
+
+    /****** Tree update with a different particle set ****************/
+    {
+        // the leaves of the first set are only the starting guess for the second and must be rebalanced
+        auto otherDistribution = distribution == ParticleDistribution::plummer ? ParticleDistribution::uniform
+                                                                                : ParticleDistribution::plummer;
+        RandomCoordinates<T, KeyType> otherCoords(numParticles, box, otherDistribution);
+        const KeyType*                otherKeys = otherCoords.keys().data();
+
+        OctreeManager<T, KeyType> updatedTree(bucketSize);
+        updatedTree.update(keys, keys + numParticles, box);
+        updatedTree.update(otherKeys, otherKeys + numParticles, box);
+
+        const auto& counts     = updatedTree.counts();
+        bool        updatePass = std::all_of(counts.begin(), counts.end(), [&](unsigned c) { return c <= bucketSize; });
+        std::cout << "tree update with a different particle set: " << counts.size() << " leaves, bucket sizes "
+                  << (updatePass ? "PASS" : "FAIL") << std::endl;
+    }
+
+    /****** Octree file round trip ****************/
+    {
+        std::string fileName = "octree_snapshot.bin";
+
+        OctreeSnapshot<T, KeyType> snapshot{keys,
+                                            uint64_t(numParticles),
+                                            tree.csTree().data(),
+                                            tree.counts().data(),
+                                            tree.octreeView(),
+                                            layout.data(),
+                                            nodeCenters.data(),
+                                            nodeSizes.data(),
+                                            box};
+        writeOctreeFile(fileName, snapshot);
+
+        std::unique_ptr<MappedOctreeFile<T, KeyType>> mapped;
+        auto loadTree = [&]() { mapped = std::make_unique<MappedOctreeFile<T, KeyType>>(fileName); };
+
+        float loadTime = timeCpu(loadTree);
+
+        std::vector<LocalIndex> neighborsLoaded(maxNeighbors * numParticles);
+        std::vector<unsigned>   neighborsCountLoaded(numParticles);
+        findNeighborsGroups(x, y, z, h.data(), numParticles, mapped->nsView(), mapped->box(), maxNeighbors,
+                            neighborsLoaded.data(), neighborsCountLoaded.data());
+
+        bool loadPass = std::equal(neighborsCountLoaded.begin(), neighborsCountLoaded.end(), neighborsCountCPU.begin());
+        std::cout << "octree file map time " << loadTime << " s, neighbor counts " << (loadPass ? "PASS" : "FAIL")
+                  << std::endl;
+
+        mapped.reset();
+        std::remove(fileName.c_str());
+    }
+
+    /****** Particle snapshot round trip with zero-copy mapping ****************/
+    {
+        std::string fileName = "particle_snapshot.bin";
+        writeParticleSnapshot(fileName, x, y, z, h.data(), uint64_t(numParticles), box, true);
+
+        std::unique_ptr<MappedParticleSnapshot<T>> mapped;
+        float mapTime = timeCpu([&]() { mapped = std::make_unique<MappedParticleSnapshot<T>>(fileName); });
+
+        bool mapPass = mapped->numParticles() == uint64_t(numParticles) && mapped->box() == box &&
+                       std::equal(x, x + numParticles, mapped->x()) && std::equal(y, y + numParticles, mapped->y()) &&
+                       std::equal(z, z + numParticles, mapped->z()) && std::equal(h.begin(), h.end(), mapped->h());
+
+        // search directly on the mapped coordinates, they are in the SFC order of the tree
+        std::vector<LocalIndex> neighborsMapped(maxNeighbors * numParticles);
+        std::vector<unsigned>   neighborsCountMapped(numParticles);
+        findNeighborsGroups(mapped->x(), mapped->y(), mapped->z(), mapped->h(), numParticles, treeView, mapped->box(),
+                            maxNeighbors, neighborsMapped.data(), neighborsCountMapped.data());
+        mapPass &= std::equal(neighborsCountMapped.begin(), neighborsCountMapped.end(), neighborsCountCPU.begin());
+
+        std::cout << "particle snapshot map time " << mapTime << " s, coordinates and neighbor counts "
+                  << (mapPass ? "PASS" : "FAIL") << std::endl;
+
+        mapped.reset();
+        std::remove(fileName.c_str());
+    }
+
     /****** Upload input data to GPU ****************/
-    thrust::device_vector<T> d_x(coords.x().begin(), coords.x().end());
-    thrust::device_vector<T> d_y(coords.y().begin(), coords.y().end());
-    thrust::device_vector<T> d_z(coords.z().begin(), coords.z().end());
+    thrust::device_vector<T> d_x = xData;
+    thrust::device_vector<T> d_y = yData;
+    thrust::device_vector<T> d_z = zData;
     thrust::device_vector<T> d_h = h;
 
     thrust::device_vector<Vec3<T>>       d_nodeCenters    = nodeCenters;
@@ -109,8 +555,12 @@ void benchmarkGpu(int numParticles, bool verbose)
     thrust::device_vector<TreeNodeIndex> d_internalToLeaf = octree.internalToLeaf;
     thrust::device_vector<LocalIndex>    d_layout         = layout;
 
-    OctreeNsView<T, KeyType> treeViewGpu{rawPtr(d_nodeCenters), rawPtr(d_nodeSizes), rawPtr(d_childOffsets),
-                                         rawPtr(d_internalToLeaf), rawPtr(d_layout)};
+    // stackless traversal on the GPU, avoids the per-thread traversal stack in local memory
+    tree.updateEscapeIndices();
+    thrust::device_vector<TreeNodeIndex> d_escapeIndices = octree.escapeIndices;
+
+    OctreeNsView<T, KeyType> treeViewGpu{rawPtr(d_nodeCenters),    rawPtr(d_nodeSizes), rawPtr(d_childOffsets),
+                                         rawPtr(d_internalToLeaf), rawPtr(d_layout),    rawPtr(d_escapeIndices)};
 
     /****** GPU output data ****************/
     thrust::device_vector<LocalIndex> d_neighbors(numParticles * maxNeighbors);
@@ -181,7 +631,9 @@ void benchmarkGpu(int numParticles, bool verbose)
     }
 
     bool allEqual = std::equal(begin(neighborsCountGPU), end(neighborsCountGPU), begin(neighborsCountCPU));
-    if (allEqual && all2allpass)
+    bool refEqual = neighborsCountRef.empty() ||
+                    std::equal(begin(neighborsCountGPU), end(neighborsCountGPU), begin(neighborsCountRef));
+    if (allEqual && refEqual && all2allpass)
         std::cout << "GPU neighbor counts: PASS\n";
     else
         std::cout << "GPU neighbor counts: FAIL " << numFails << std::endl;
@@ -191,9 +643,54 @@ void benchmarkGpu(int numParticles, bool verbose)
 
 int main(int argc, char** argv)
 {
-    int  numParticles = (argc > 1) ? std::stoi(argv[1]) : 10000;
-    bool verbose      = false;
+    const std::string usage = "usage: neighbor_search [numParticles] [distribution] [--snapshot file] [--periodic]";
 
-    std::cout << "Performing neighbor search for " << numParticles << " particles." << std::endl;
-    benchmarkGpu<double, uint64_t>(numParticles, verbose);
+    int         numParticles = 10000;
+    std::string distribution = "uniform";
+    std::string  snapshotFile;
+    BoundaryType boundary = BoundaryType::open;
+    bool         verbose  = false;
+
+    // snapshots are selected explicitly, such that file names are never mistaken for particle counts
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--snapshot" && i + 1 < argc) { snapshotFile = argv[++i]; }
+        else if (arg == "--periodic") { boundary = BoundaryType::periodic; }
+        else if (arg.rfind("--", 0) == 0)
+        {
+            std::cerr << "invalid option or missing value: " << arg << "\n" << usage << std::endl;
+            return EXIT_FAILURE;
+        }
+        else { positional.push_back(arg); }
+    }
+    if (positional.size() > 2)
+    {
+        std::cerr << usage << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (!positional.empty())
+    {
+        const std::string& count    = positional[0];
+        bool               isNumber = std::all_of(count.begin(), count.end(), [](char c) { return std::isdigit(c); });
+        if (count.empty() || count.size() > 9 || !isNumber || std::stoi(count) == 0)
+        {
+            std::cerr << "invalid particle count " << count << "\n" << usage << std::endl;
+            return EXIT_FAILURE;
+        }
+        numParticles = std::stoi(count);
+    }
+    if (positional.size() > 1) { distribution = positional[1]; }
+
+    if (!snapshotFile.empty())
+    {
+        std::cout << "Performing neighbor search for particles in " << snapshotFile << std::endl;
+    }
+    else
+    {
+        std::cout << "Performing neighbor search for " << numParticles << " " << distribution << " particles in a "
+                  << (boundary == BoundaryType::periodic ? "periodic" : "open") << " box." << std::endl;
+    }
+    benchmarkGpu<double, uint64_t>(numParticles, parseDistribution(distribution), boundary, snapshotFile, verbose);
 }
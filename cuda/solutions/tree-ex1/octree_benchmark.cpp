@@ -0,0 +1,410 @@
+/*! @file
+ * @brief  Octree benchmark suite: times each stage from particles to neighbor lists and reports JSON
+ *
+ * @author Sebastian Keller <sebastian.f.keller@gmail.com>
+ *
+ * Sweeps over all combinations of the given particle counts, bucket sizes, key widths, distributions and
+ * thread counts. Each configuration runs the full pipeline once as warm-up, then @p repetitions times with
+ * the following stages timed separately:
+ *
+ *  - keys:       SFC key computation
+ *  - sort:       sort by key and gather coordinates
+ *  - build:      cornerstone leaves from scratch
+ *  - update:     one rebalance and count step, starting from the converged leaves
+ *  - linked:     linked octree construction
+ *  - centers:    geometric node centers and sizes
+ *  - escape:     escape indices for stackless traversal
+ *  - neighbors:  two-phase neighbor search into CSR lists
+ *  - stackless:  the same neighbor search with stackless traversal
+ *
+ * usage: octree_benchmark [--particles 100000,1000000] [--buckets 16,64] [--keys 32,64]
+ *                         [--distributions uniform,clusters] [--threads 1,2,4] [--neighbors 64]
+ *                         [--repetitions 5] [--output results.json]
+ *
+ * Progress is reported on stderr, the JSON results go to the output file, or to stdout if none is given.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "util/distributions.hpp"
+#include "util/primitives.hpp"
+#include "util/timing.cuh"
+
+#include "tree/csarray.hpp"
+#include "tree/octree.hpp"
+#include "findneighbors_groups.hpp"
+
+using namespace cstone;
+
+struct BenchmarkConfig
+{
+    std::size_t numParticles;
+    unsigned    bucketSize;
+    int         keyBits;
+    std::string distribution;
+    int         numThreads;
+};
+
+struct StageTimes
+{
+    std::string        name;
+    std::vector<float> samples;
+};
+
+//! @brief tree and search statistics of one configuration, to interpret the timings
+struct PipelineStats
+{
+    TreeNodeIndex numLeafNodes{0};
+    TreeNodeIndex numEmptyLeaves{0};
+    unsigned      maxLeafLevel{0};
+    double        meanNeighbors{0};
+};
+
+/*! @brief initial smoothing lengths for about @p ngTarget neighbors from the particle density of the enclosing leaf
+ *
+ * Uses a cornerstone tree with bucket size @p ngTarget, such that each leaf volume samples the density on the
+ * scale of the neighbor sphere.
+ */
+template<class T, class KeyType>
+std::vector<T> estimateSmoothingLengths(const KeyType* keys, std::size_t n, const Box<T>& box, unsigned ngTarget)
+{
+    auto [leaves, counts] = computeOctree(keys, keys + n, ngTarget);
+
+    std::vector<LocalIndex> layout(counts.size() + 1);
+    layout.back() = exclusiveScan(counts.data(), layout.data(), counts.size(), LocalIndex(0));
+
+    std::vector<T> h(n);
+#pragma omp parallel for schedule(static)
+    for (std::size_t leaf = 0; leaf < counts.size(); ++leaf)
+    {
+        T volume = box.lx() * box.ly() * box.lz() / std::pow(T(8), treeLevel(leaves[leaf + 1] - leaves[leaf]));
+        T radius = std::cbrt(T(3) / (4 * M_PI) * volume * ngTarget / std::max(counts[leaf], 1u));
+        std::fill(h.begin() + layout[leaf], h.begin() + layout[leaf + 1], T(0.5) * radius);
+    }
+    return h;
+}
+
+template<class KeyType>
+std::vector<StageTimes>
+benchmarkPipeline(const BenchmarkConfig& config, unsigned ngTarget, int repetitions, PipelineStats& stats)
+{
+    using T = double;
+
+    Box<T>      box{0, 1};
+    std::size_t n = config.numParticles;
+
+    std::vector<T> xGen(n), yGen(n), zGen(n);
+    generateParticles(parseDistribution(config.distribution), xGen.data(), yGen.data(), zGen.data(), n, box, 42);
+
+    std::vector<KeyType>     keys(n);
+    std::vector<std::size_t> sfcOrder(n);
+    std::vector<T>           x(n), y(n), z(n), h;
+
+    std::vector<KeyType>       csTree, tmpTree;
+    std::vector<unsigned>      counts;
+    std::vector<TreeNodeIndex> nodeOps;
+    std::vector<LocalIndex>    layout;
+
+    OctreeData<KeyType, CpuTag> octree;
+    std::vector<Vec3<T>>        centers, sizes;
+    NeighborListsCsr            neighbors;
+
+    auto computeKeys = [&]() { computeSfcKeys(xGen.data(), yGen.data(), zGen.data(), keys.data(), n, box); };
+
+    auto sortParticles = [&]()
+    {
+        std::iota(sfcOrder.begin(), sfcOrder.end(), std::size_t(0));
+        sort_by_key(keys.begin(), keys.end(), sfcOrder.begin());
+        gather(sfcOrder.data(), n, xGen.data(), x.data());
+        gather(sfcOrder.data(), n, yGen.data(), y.data());
+        gather(sfcOrder.data(), n, zGen.data(), z.data());
+    };
+
+    auto buildTree = [&]()
+    {
+        csTree = {0, nodeRange<KeyType>(0)};
+        counts = {unsigned(n)};
+        while (!updateOctree(keys.data(), keys.data() + n, config.bucketSize, csTree, counts, tmpTree, nodeOps))
+            ;
+    };
+
+    auto updateTree = [&]()
+    { updateOctree(keys.data(), keys.data() + n, config.bucketSize, csTree, counts, tmpTree, nodeOps); };
+
+    auto buildLinked = [&]()
+    {
+        octree.resize(nNodes(csTree));
+        buildLinkedTree<KeyType>(csTree.data(), octree.data());
+    };
+
+    auto computeCenters = [&]()
+    {
+        centers.resize(octree.numNodes);
+        sizes.resize(octree.numNodes);
+        nodeFpCenters(octree.prefixes.data(), octree.numNodes, centers.data(), sizes.data(), box);
+    };
+
+    auto buildEscape = [&]() { buildEscapeIndices(octree); };
+
+    auto nsView = [&]() -> OctreeNsView<T, KeyType>
+    {
+        return {centers.data(), sizes.data(), octree.childOffsets.data(), octree.internalToLeaf.data(),
+                layout.data()};
+    };
+
+    auto searchNeighbors = [&]()
+    { findNeighborsCsr(x.data(), y.data(), z.data(), h.data(), n, nsView(), box, neighbors); };
+
+    auto searchStackless = [&]()
+    {
+        OctreeNsView<T, KeyType> view = nsView();
+        view.escapeIndices            = octree.escapeIndices.data();
+        findNeighborsCsr(x.data(), y.data(), z.data(), h.data(), n, view, box, neighbors);
+    };
+
+    std::vector<StageTimes> stages{{"keys", {}},    {"sort", {}},      {"build", {}},
+                                   {"update", {}},  {"linked", {}},    {"centers", {}},
+                                   {"escape", {}},  {"neighbors", {}}, {"stackless", {}}};
+
+    for (int rep = 0; rep <= repetitions; ++rep)
+    {
+        float times[] = {timeCpu(computeKeys), timeCpu(sortParticles), timeCpu(buildTree), timeCpu(updateTree),
+                         timeCpu(buildLinked), timeCpu(computeCenters), timeCpu(buildEscape)};
+
+        if (rep == 0)
+        {
+            // the layout and smoothing lengths are inputs of the search, not part of the timed pipeline
+            layout.resize(counts.size() + 1);
+            layout.back() = exclusiveScan(counts.data(), layout.data(), counts.size(), LocalIndex(0));
+            h             = estimateSmoothingLengths(keys.data(), n, box, ngTarget);
+
+            // correct the density estimate with a few Newton steps on n(h) ~ h^3, using count-only searches
+            for (int round = 0; round < 3; ++round)
+            {
+#pragma omp parallel for schedule(dynamic, 64)
+                for (std::size_t i = 0; i < n; ++i)
+                {
+                    unsigned nc = findNeighbors(LocalIndex(i), x.data(), y.data(), z.data(), h.data(), nsView(), box,
+                                                0u, static_cast<LocalIndex*>(nullptr));
+                    h[i] *= std::clamp(std::cbrt(T(ngTarget + 1) / T(nc + 1)), T(0.5), T(2));
+                }
+            }
+        }
+        float searchTime    = timeCpu(searchNeighbors);
+        float stacklessTime = timeCpu(searchStackless);
+
+        // the first round is a warm-up
+        if (rep == 0) { continue; }
+        for (int s = 0; s < 7; ++s)
+        {
+            stages[s].samples.push_back(times[s]);
+        }
+        stages[7].samples.push_back(searchTime);
+        stages[8].samples.push_back(stacklessTime);
+    }
+
+    stats.numLeafNodes   = nNodes(csTree);
+    stats.numEmptyLeaves = std::count(counts.begin(), counts.end(), 0u);
+    stats.maxLeafLevel   = 0;
+    for (std::size_t i = 0; i < nNodes(csTree); ++i)
+    {
+        stats.maxLeafLevel = std::max(stats.maxLeafLevel, treeLevel(csTree[i + 1] - csTree[i]));
+    }
+    stats.meanNeighbors = double(neighbors.indices.size()) / n;
+
+    return stages;
+}
+
+//! @brief write min, median, mean and max of @p samples as JSON object
+void writeSummary(std::ostream& out, std::vector<float> samples)
+{
+    std::sort(samples.begin(), samples.end());
+    std::size_t m      = samples.size();
+    double      median = (m % 2) ? samples[m / 2] : 0.5 * (samples[m / 2 - 1] + samples[m / 2]);
+    double      mean   = std::accumulate(samples.begin(), samples.end(), 0.0) / m;
+
+    out << "{\"min\": " << samples.front() << ", \"median\": " << median << ", \"mean\": " << mean
+        << ", \"max\": " << samples.back() << "}";
+}
+
+template<class V>
+std::vector<V> parseList(const std::string& arg)
+{
+    std::vector<V>     values;
+    std::istringstream stream(arg);
+    std::string        item;
+    while (std::getline(stream, item, ','))
+    {
+        V value;
+        if (!(std::istringstream(item) >> value)) { throw std::invalid_argument("invalid value " + item); }
+        values.push_back(value);
+    }
+    return values;
+}
+
+//! @brief parse a positive integer that fits into V, naming @p option in the error message
+template<class V>
+V parsePositive(const std::string& item, const std::string& option)
+{
+    long long   value = 0;
+    std::size_t end   = 0;
+    try
+    {
+        value = std::stoll(item, &end);
+    }
+    catch (const std::exception&)
+    {
+        end = 0;
+    }
+    if (end == 0 || end != item.size() || value < 1 ||
+        static_cast<unsigned long long>(value) > static_cast<unsigned long long>(std::numeric_limits<V>::max()))
+    {
+        throw std::invalid_argument(option + " requires positive integers up to " +
+                                    std::to_string(std::numeric_limits<V>::max()) + ", got " + item);
+    }
+    return V(value);
+}
+
+//! @brief parse a non-empty comma-separated list of positive integers
+template<class V>
+std::vector<V> parsePositiveList(const std::string& arg, const std::string& option)
+{
+    std::vector<V> values;
+    for (const auto& item : parseList<std::string>(arg))
+    {
+        values.push_back(parsePositive<V>(item, option));
+    }
+    if (values.empty()) { throw std::invalid_argument(option + " requires at least one value"); }
+    return values;
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<std::size_t> particleCounts{100000, 1000000};
+    std::vector<unsigned>    bucketSizes{16, 64};
+    std::vector<int>         keyBits{32, 64};
+    std::vector<std::string> distributions{"uniform", "clusters"};
+    std::vector<int>         threadCounts{detail::maxThreads()};
+    unsigned                 ngTarget    = 64;
+    int                      repetitions = 5;
+    std::string              outputFile;
+    std::ofstream            outputStream;
+
+    try
+    {
+        for (int i = 1; i < argc; i += 2)
+        {
+            std::string flag  = argv[i];
+            auto        value = [flag, i, argc, argv]()
+            {
+                if (i + 1 == argc) { throw std::invalid_argument("option " + flag + " requires a value"); }
+                return std::string(argv[i + 1]);
+            };
+
+            if (flag == "--particles") { particleCounts = parsePositiveList<std::size_t>(value(), flag); }
+            else if (flag == "--buckets") { bucketSizes = parsePositiveList<unsigned>(value(), flag); }
+            else if (flag == "--keys") { keyBits = parsePositiveList<int>(value(), flag); }
+            else if (flag == "--distributions") { distributions = parseList<std::string>(value()); }
+            else if (flag == "--threads") { threadCounts = parsePositiveList<int>(value(), flag); }
+            else if (flag == "--neighbors") { ngTarget = parsePositive<unsigned>(value(), flag); }
+            else if (flag == "--repetitions") { repetitions = parsePositive<int>(value(), flag); }
+            else if (flag == "--output") { outputFile = value(); }
+            else { throw std::invalid_argument("unknown option " + flag); }
+        }
+
+        // validate everything before the sweep, such that no configuration fails after others have already run
+        for (int bits : keyBits)
+        {
+            if (bits != 32 && bits != 64) { throw std::invalid_argument("--keys must be 32 or 64"); }
+        }
+        if (distributions.empty()) { throw std::invalid_argument("--distributions requires at least one value"); }
+        for (const auto& distribution : distributions)
+        {
+            parseDistribution(distribution);
+        }
+        if (!outputFile.empty())
+        {
+            outputStream.open(outputFile);
+            if (!outputStream) { throw std::runtime_error("cannot open output file " + outputFile); }
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::ostringstream json;
+    json << "{\n  \"repetitions\": " << repetitions << ",\n  \"neighborTarget\": " << ngTarget
+         << ",\n  \"results\": [";
+
+    std::vector<BenchmarkConfig> configs;
+    for (std::size_t numParticles : particleCounts)
+    {
+        for (const auto& distribution : distributions)
+        {
+            for (unsigned bucketSize : bucketSizes)
+            {
+                for (int bits : keyBits)
+                {
+                    for (int numThreads : threadCounts)
+                    {
+                        configs.push_back({numParticles, bucketSize, bits, distribution, numThreads});
+                    }
+                }
+            }
+        }
+    }
+
+    for (std::size_t c = 0; c < configs.size(); ++c)
+    {
+        const auto& config = configs[c];
+#ifdef _OPENMP
+        omp_set_num_threads(config.numThreads);
+#endif
+        std::cerr << "[" << c + 1 << "/" << configs.size() << "] " << config.numParticles << " "
+                  << config.distribution << " particles, bucket size " << config.bucketSize << ", " << config.keyBits
+                  << "-bit keys, " << config.numThreads << " threads" << std::endl;
+
+        PipelineStats           stats;
+        std::vector<StageTimes> stages = (config.keyBits == 32)
+                                             ? benchmarkPipeline<unsigned>(config, ngTarget, repetitions, stats)
+                                             : benchmarkPipeline<uint64_t>(config, ngTarget, repetitions, stats);
+
+        json << (c ? ",\n" : "\n") << "    {\"numParticles\": " << config.numParticles << ", \"distribution\": \""
+             << config.distribution << "\", \"bucketSize\": " << config.bucketSize
+             << ", \"keyBits\": " << config.keyBits << ", \"numThreads\": " << config.numThreads
+             << ",\n     \"numLeafNodes\": " << stats.numLeafNodes << ", \"numEmptyLeaves\": " << stats.numEmptyLeaves
+             << ", \"maxLeafLevel\": " << stats.maxLeafLevel << ", \"meanNeighbors\": " << stats.meanNeighbors
+             << ",\n     \"seconds\": {";
+        for (std::size_t s = 0; s < stages.size(); ++s)
+        {
+            json << (s ? ",\n                 " : "") << "\"" << stages[s].name << "\": ";
+            writeSummary(json, stages[s].samples);
+        }
+        json << "}}";
+    }
+    json << "\n  ]\n}\n";
+
+    if (outputFile.empty()) { std::cout << json.str(); }
+    else
+    {
+        outputStream << json.str();
+        outputStream.close();
+        if (!outputStream)
+        {
+            std::cerr << "failed to write results to " << outputFile << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+}
@@ -0,0 +1,216 @@
+/*! @file
+ * @brief  Axis-aligned box and frustum range queries returning contiguous SFC particle ranges
+ *
+ * @author Sebastian Keller <sebastian.f.keller@gmail.com>
+ *
+ * The particles of each octree node form a contiguous index range in SFC order. A range query therefore emits
+ * the particle range of every node that lies entirely inside the query region without descending further,
+ * and only tests individual particles in the leaves that intersect the region boundary. The cost is
+ * proportional to the boundary of the region rather than its volume. The result is a sorted list of
+ * disjoint particle index ranges, with adjacent ranges merged.
+ *
+ * A region R provides three tests:
+ *  - R.containsBox(center, size):  true if the box lies entirely inside the region
+ *  - R.overlapsBox(center, size):  false only if the box lies entirely outside the region
+ *  - R.containsPoint(X):           true if the point lies inside the region
+ *
+ * Queries are open-box only: regions are not wrapped across periodic boundaries, such that a region extending
+ * beyond a periodic box does not find the images of particles on the opposite side.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+#include "findneighbors.hpp"
+
+namespace cstone
+{
+
+//! @brief particle index range [first, second)
+using ParticleRange = std::pair<LocalIndex, LocalIndex>;
+
+//! @brief the axis-aligned box [lo, hi]
+template<class T>
+struct AabbRegion
+{
+    Vec3<T> lo;
+    Vec3<T> hi;
+
+    bool containsBox(const Vec3<T>& center, const Vec3<T>& size) const
+    {
+        Vec3<T> bLo = center - size, bHi = center + size;
+        return bLo[0] >= lo[0] && bLo[1] >= lo[1] && bLo[2] >= lo[2] && bHi[0] <= hi[0] && bHi[1] <= hi[1] &&
+               bHi[2] <= hi[2];
+    }
+
+    bool overlapsBox(const Vec3<T>& center, const Vec3<T>& size) const
+    {
+        return norm2(minDistance(center, size, T(0.5) * (hi + lo), T(0.5) * (hi - lo))) == T(0);
+    }
+
+    bool containsPoint(const Vec3<T>& X) const
+    {
+        return X[0] >= lo[0] && X[1] >= lo[1] && X[2] >= lo[2] && X[0] <= hi[0] && X[1] <= hi[1] && X[2] <= hi[2];
+    }
+};
+
+/*! @brief convex region bounded by 6 planes
+ *
+ * Each plane is stored as (n_x, n_y, n_z, d), points X with dot(n, X) + d >= 0 lie on the inner side.
+ * The box tests are exact per plane, but overlapsBox is conservative near the frustum edges and corners:
+ * a box outside the frustum that is not entirely behind any single plane is reported as overlapping.
+ */
+template<class T>
+struct FrustumRegion
+{
+    util::array<Vec4<T>, 6> planes;
+
+    bool containsBox(const Vec3<T>& center, const Vec3<T>& size) const
+    {
+        for (const auto& p : planes)
+        {
+            Vec3<T> n{p[0], p[1], p[2]};
+            if (dot(n, center) + p[3] - dot(abs(n), size) < T(0)) { return false; }
+        }
+        return true;
+    }
+
+    bool overlapsBox(const Vec3<T>& center, const Vec3<T>& size) const
+    {
+        for (const auto& p : planes)
+        {
+            Vec3<T> n{p[0], p[1], p[2]};
+            if (dot(n, center) + p[3] + dot(abs(n), size) < T(0)) { return false; }
+        }
+        return true;
+    }
+
+    bool containsPoint(const Vec3<T>& X) const
+    {
+        for (const auto& p : planes)
+        {
+            if (p[0] * X[0] + p[1] * X[1] + p[2] * X[2] + p[3] < T(0)) { return false; }
+        }
+        return true;
+    }
+};
+
+/*! @brief construct the view frustum of a perspective camera
+ *
+ * @param eye       camera position
+ * @param forward   viewing direction
+ * @param up        approximate up direction, must not be parallel to @p forward
+ * @param fovY      vertical opening angle in radians
+ * @param aspect    ratio of horizontal to vertical opening
+ * @param nearDist  distance of the near clipping plane to @p eye
+ * @param farDist   distance of the far clipping plane to @p eye
+ */
+template<class T>
+FrustumRegion<T> makeFrustum(
+    const Vec3<T>& eye, Vec3<T> forward, const Vec3<T>& up, T fovY, T aspect, T nearDist, T farDist)
+{
+    forward *= T(1) / std::sqrt(norm2(forward));
+    Vec3<T> right = cross(forward, up);
+    right *= T(1) / std::sqrt(norm2(right));
+    Vec3<T> upOrtho = cross(right, forward);
+
+    T tanY = std::tan(T(0.5) * fovY);
+    T tanX = tanY * aspect;
+
+    auto plane = [&eye](const Vec3<T>& n, T offset) { return Vec4<T>{n[0], n[1], n[2], offset - dot(n, eye)}; };
+
+    FrustumRegion<T> frustum;
+    frustum.planes[0] = plane(forward, -nearDist);
+    frustum.planes[1] = plane(T(-1) * forward, farDist);
+    frustum.planes[2] = plane(tanX * forward - right, 0);
+    frustum.planes[3] = plane(tanX * forward + right, 0);
+    frustum.planes[4] = plane(tanY * forward - upOrtho, 0);
+    frustum.planes[5] = plane(tanY * forward + upOrtho, 0);
+    return frustum;
+}
+
+//! @brief sort ranges and merge adjacent ones
+inline void mergeRanges(std::vector<ParticleRange>& ranges)
+{
+    std::sort(ranges.begin(), ranges.end());
+
+    std::size_t numMerged = 0;
+    for (const auto& r : ranges)
+    {
+        if (numMerged > 0 && ranges[numMerged - 1].second == r.first) { ranges[numMerged - 1].second = r.second; }
+        else { ranges[numMerged++] = r; }
+    }
+    ranges.resize(numMerged);
+}
+
+/*! @brief find all particles inside a region
+ *
+ * @param[in]  region  query region, see file description for the required interface
+ * @param[in]  x,y,z   particle coordinates in SFC order
+ * @param[in]  tree    octree connectivity, node boxes and particle layout
+ * @return             sorted, disjoint and non-adjacent index ranges of the particles inside @p region
+ */
+template<class Region, class T, class KeyType>
+std::vector<ParticleRange>
+rangeQuery(const Region& region, const T* x, const T* y, const T* z, const OctreeNsView<T, KeyType>& tree)
+{
+    std::vector<ParticleRange> ranges;
+
+    // the particles of a subtree are those between the first particle of its leftmost leaf
+    // and the last particle of its rightmost leaf
+    auto subtreeRange = [&tree](TreeNodeIndex idx)
+    {
+        TreeNodeIndex first = idx, last = idx;
+        while (tree.childOffsets[first] != 0)
+        {
+            first = tree.childOffsets[first];
+        }
+        while (tree.childOffsets[last] != 0)
+        {
+            last = tree.childOffsets[last] + 7;
+        }
+        return ParticleRange{tree.layout[tree.internalToLeaf[first]], tree.layout[tree.internalToLeaf[last] + 1]};
+    };
+
+    auto descend = [&](TreeNodeIndex idx)
+    {
+        const Vec3<T>& size = tree.sizes[idx];
+        if (size[0] < T(0) || !region.overlapsBox(tree.centers[idx], size)) { return false; } // empty or outside
+
+        if (region.containsBox(tree.centers[idx], size))
+        {
+            auto range = subtreeRange(idx);
+            if (range.first < range.second) { ranges.push_back(range); }
+            return false;
+        }
+        return true;
+    };
+
+    // leaf on the region boundary: emit runs of consecutive particles inside the region
+    auto filterLeaf = [&](TreeNodeIndex idx)
+    {
+        TreeNodeIndex leafIdx  = tree.internalToLeaf[idx];
+        LocalIndex    runStart = tree.layout[leafIdx];
+        LocalIndex    last     = tree.layout[leafIdx + 1];
+        for (LocalIndex j = runStart; j < last; ++j)
+        {
+            if (!region.containsPoint(Vec3<T>{x[j], y[j], z[j]}))
+            {
+                if (runStart < j) { ranges.emplace_back(runStart, j); }
+                runStart = j + 1;
+            }
+        }
+        if (runStart < last) { ranges.emplace_back(runStart, last); }
+    };
+
+    traverseTree(tree.childOffsets, tree.escapeIndices, descend, filterLeaf);
+    mergeRanges(ranges);
+
+    return ranges;
+}
+
+} // namespace cstone
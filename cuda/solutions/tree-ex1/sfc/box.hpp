@@ -138,6 +138,27 @@ HOST_DEVICE_FUN inline Vec3<T> applyPbc(Vec3<T> dX, const Box<T>& box)
     return dX;
 }
 
+//! @brief the box lengths of periodic dimensions and zero for open dimensions, see minImage
+template<class T>
+HOST_DEVICE_FUN inline Vec3<T> periodLengths(const Box<T>& box)
+{
+    return {box.lx() * (box.boundaryX() == BoundaryType::periodic),
+            box.ly() * (box.boundaryY() == BoundaryType::periodic),
+            box.lz() * (box.boundaryZ() == BoundaryType::periodic)};
+}
+
+/*! @brief minimum image of a coordinate difference dx between two points inside the box
+ *
+ * Branch-free alternative to applyPbc for vectorized loops, valid for |dx| < period, which holds for any two
+ * points inside the box. A @p period of zero (open boundaries) leaves @p dx unchanged.
+ */
+template<class T>
+HOST_DEVICE_FUN inline T minImage(T dx, T period)
+{
+    T halfPeriod = T(0.5) * period;
+    return dx - period * T(dx > halfPeriod) + period * T(dx < -halfPeriod);
+}
+
 /*! @brief stores octree index integer bounds
  */
 template<class T>
@@ -0,0 +1,150 @@
+/*! @file
+ * @brief  Iterative adaptation of smoothing lengths to a target neighbor count
+ *
+ * @author Sebastian Keller <sebastian.f.keller@gmail.com>
+ *
+ * In SPH, each particle's smoothing length h is adjusted until 2h encloses about a prescribed number of
+ * neighbors. Each round searches the neighbors of the particles that are still active, updates h with a
+ * Newton step on n(h) ~ h^3, safeguarded by bisection, and removes converged particles from the active set.
+ * Since most particles converge after one or two rounds, later rounds only search a small fraction of them.
+ *
+ * The search is gather-type (neighbors of i are the particles within 2h_i), so the tree overlap tests only
+ * depend on the particle positions, and the tree stays valid while smoothing lengths change.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <vector>
+
+#include "util/primitives.hpp"
+#include "findneighbors.hpp"
+#include "findneighbors_groups.hpp"
+
+namespace cstone
+{
+
+//! @brief statistics of a smoothing length iteration
+struct HIterationStats
+{
+    //! @brief number of search rounds performed
+    int numRounds{0};
+    //! @brief number of particles whose neighbor count is still outside the tolerance
+    LocalIndex numUnconverged{0};
+    //! @brief total number of single-particle neighbor searches over all rounds
+    std::size_t numSearches{0};
+};
+
+/*! @brief next smoothing length estimate for a particle with @p nc neighbors within 2h
+ *
+ * @param[in]    h         current smoothing length
+ * @param[in]    nc        neighbor count within 2h
+ * @param[in]    ngTarget  target neighbor count
+ * @param[inout] hLow      largest h found so far with too few neighbors
+ * @param[inout] hHigh     smallest h found so far with too many neighbors
+ * @return                 the new smoothing length
+ */
+template<class T>
+T updateSmoothingLength(T h, unsigned nc, unsigned ngTarget, T& hLow, T& hHigh)
+{
+    if (nc < ngTarget) { hLow = std::max(hLow, h); }
+    else { hHigh = std::min(hHigh, h); }
+
+    // Newton step on log(n) = 3 log(h) + const, the +1 accounts for the particle itself and avoids nc = 0
+    T ratio = std::cbrt(T(ngTarget + 1) / T(nc + 1));
+    T hNew  = h * std::clamp(ratio, T(0.5), T(2));
+
+    // fall back to bisection if the Newton step leaves the bracket
+    if (hNew <= hLow || hNew >= hHigh)
+    {
+        hNew = (hHigh < std::numeric_limits<T>::infinity()) ? T(0.5) * (hLow + hHigh) : T(2) * hLow;
+    }
+    return hNew;
+}
+
+/*! @brief adapt smoothing lengths until each particle has ngTarget +- ngTolerance neighbors
+ *
+ * @param[in]    x,y,z          particle coordinates in SFC order
+ * @param[inout] h              smoothing lengths, input values serve as initial guess
+ * @param[in]    numParticles   number of particles
+ * @param[in]    tree           octree connectivity and particle indexing
+ * @param[in]    box            coordinate bounding box
+ * @param[in]    ngTarget       target neighbor count
+ * @param[in]    ngTolerance    accepted deviation from @p ngTarget
+ * @param[in]    maxRounds      maximum number of search rounds
+ * @param[in]    ngmax          maximum number of neighbors per particle, should exceed ngTarget + ngTolerance
+ * @param[out]   neighbors      neighbor indices, @p ngmax per particle, same layout as findNeighbors
+ * @param[out]   counts         neighbor count per particle
+ * @return                      iteration statistics
+ *
+ * On return, @p neighbors and @p counts correspond to the returned @p h for all particles, including
+ * those that did not converge within @p maxRounds.
+ */
+template<class T, class KeyType>
+HIterationStats adaptSmoothingLengths(const T* x,
+                                      const T* y,
+                                      const T* z,
+                                      T* h,
+                                      LocalIndex numParticles,
+                                      const OctreeNsView<T, KeyType>& tree,
+                                      const Box<T>& box,
+                                      unsigned ngTarget,
+                                      unsigned ngTolerance,
+                                      int maxRounds,
+                                      unsigned ngmax,
+                                      LocalIndex* neighbors,
+                                      unsigned* counts)
+{
+    HIterationStats stats;
+
+    std::vector<T> hLow(numParticles, T(0));
+    std::vector<T> hHigh(numParticles, std::numeric_limits<T>::infinity());
+
+    std::vector<LocalIndex> active(numParticles), nextActive(numParticles);
+    std::iota(active.begin(), active.end(), LocalIndex(0));
+    LocalIndex numActive = numParticles;
+
+    auto unconverged = [counts, ngTarget, ngTolerance](LocalIndex i)
+    { return counts[i] + ngTolerance < ngTarget || counts[i] > ngTarget + ngTolerance; };
+
+    while (numActive > 0 && stats.numRounds < maxRounds)
+    {
+        if (numActive == numParticles)
+        {
+            // all particles active: traverse once per group of consecutive particles
+            findNeighborsGroups(x, y, z, h, numParticles, tree, box, ngmax, neighbors, counts);
+        }
+        else
+        {
+#pragma omp parallel for schedule(dynamic, 64)
+            for (LocalIndex a = 0; a < numActive; ++a)
+            {
+                LocalIndex i = active[a];
+                counts[i]    = findNeighbors(i, x, y, z, h, tree, box, ngmax, neighbors + std::size_t(i) * ngmax);
+            }
+        }
+        stats.numSearches += numActive;
+        stats.numRounds++;
+
+        numActive = copyIf(active.data(), numActive, nextActive.data(), unconverged);
+        std::swap(active, nextActive);
+
+        // keep h of the last round, such that it matches the computed neighbors
+        if (stats.numRounds == maxRounds) { break; }
+
+#pragma omp parallel for schedule(static)
+        for (LocalIndex a = 0; a < numActive; ++a)
+        {
+            LocalIndex i = active[a];
+            h[i]         = updateSmoothingLength(h[i], counts[i], ngTarget, hLow[i], hHigh[i]);
+        }
+    }
+
+    stats.numUnconverged = numActive;
+    return stats;
+}
+
+} // namespace cstone
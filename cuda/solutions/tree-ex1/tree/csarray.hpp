@@ -30,6 +30,8 @@
 #include <vector>
 #include <tuple>
 
+#include "../util/primitives.hpp"
+#include "../util/reallocate.hpp"
 #include "../util/stl.hpp"
 #include "../util/tuple.hpp"
 
@@ -80,6 +82,9 @@ HOST_DEVICE_FUN unsigned calculateNodeCount(
  * @param[in]    codesStart   sorted particle SFC code range start
  * @param[in]    codesEnd     sorted particle SFC code range end
  * @param[in]    maxCount     maximum particle count per node to store
+ *
+ * Tree nodes and particle keys are both sorted, so instead of two binary searches per node,
+ * both sequences are walked together with a parallel merge-path partition.
  */
 template<class KeyType>
 void computeNodeCounts(const KeyType* tree,
@@ -89,11 +94,15 @@ void computeNodeCounts(const KeyType* tree,
                        const KeyType *codesEnd,
                        unsigned maxCount)
 {
-#pragma omp parallel for schedule(static)
-    for (TreeNodeIndex i = 0; i < numNodes; ++i)
-    {
-        counts[i] = calculateNodeCount(tree[i], tree[i + 1], codesStart, codesEnd, maxCount);
-    }
+    // restrict the particle keys to the range covered by the tree
+    const KeyType* firstCode = stl::lower_bound(codesStart, codesEnd, tree[0]);
+    const KeyType* lastCode  = stl::lower_bound(firstCode, codesEnd, tree[numNodes]);
+
+    auto nodeStart  = [tree](std::size_t i) { return tree[i]; };
+    auto storeCount = [counts, maxCount](std::size_t i, std::size_t first, std::size_t last)
+    { counts[i] = stl::min(last - first, std::size_t(maxCount)); };
+
+    mergePathRanges(nodeStart, numNodes, firstCode, lastCode - firstCode, storeCount);
 }
 
 /*! @brief return the sibling index and level of the specified csTree node
@@ -228,7 +237,7 @@ void rebalanceTree(const InputVector& tree, OutputVector& newTree, TreeNodeIndex
 {
     TreeNodeIndex numNodes = nNodes(tree);
 
-    std::exclusive_scan(nodeOps, nodeOps + numNodes + 1, nodeOps, 0); // add 1 to store the total sum
+    exclusiveScan(nodeOps, nodeOps, numNodes + 1); // add 1 to store the total sum
     TreeNodeIndex newNumNodes = nodeOps[numNodes];
 
     newTree.resize(newNumNodes + 1); // histogram size is number of nodes + 1
@@ -241,7 +250,7 @@ void rebalanceTree(const InputVector& tree, OutputVector& newTree, TreeNodeIndex
     newTree.back() = tree.back();
 }
 
-/*! @brief update the octree with a single rebalance/count step
+/*! @brief update the octree with a single rebalance/count step, reusing caller-provided scratch buffers
  *
  * @tparam       KeyType     32- or 64-bit unsigned integer for SFC code
  * @param[in]    firstKey    first local particle SFC key
@@ -249,8 +258,13 @@ void rebalanceTree(const InputVector& tree, OutputVector& newTree, TreeNodeIndex
  * @param[in]    bucketSize  maximum number of particles per node
  * @param[inout] tree        the octree leaf nodes (cornerstone format)
  * @param[inout] counts      the octree leaf node particle count
+ * @param[-]     tmpTree     scratch space for the rebalanced tree, swapped with @p tree on return
+ * @param[-]     nodeOps     scratch space for the rebalance decisions
  * @param[in]    maxCount    if actual node counts are higher, they will be capped to @p maxCount
  * @return                   true if tree was not modified, false otherwise
+ *
+ * The scratch buffers only grow, such that repeated calls with the same buffers do not allocate
+ * once the tree size has stabilized.
  */
 template<class KeyType>
 bool updateOctree(const KeyType* firstKey,
@@ -258,21 +272,48 @@ bool updateOctree(const KeyType* firstKey,
                   unsigned bucketSize,
                   std::vector<KeyType>& tree,
                   std::vector<unsigned>& counts,
+                  std::vector<KeyType>& tmpTree,
+                  std::vector<TreeNodeIndex>& nodeOps,
                   unsigned maxCount = std::numeric_limits<unsigned>::max())
 {
-    std::vector<TreeNodeIndex> nodeOps(nNodes(tree) + 1);
+    constexpr double growthRate = 1.05;
+
+    reallocate(nodeOps, nNodes(tree) + 1, growthRate);
     bool converged = rebalanceDecision(tree.data(), counts.data(), nNodes(tree), bucketSize, nodeOps.data());
 
-    std::vector<KeyType> tmpTree;
     rebalanceTree(tree, tmpTree, nodeOps.data());
     swap(tree, tmpTree);
 
-    counts.resize(nNodes(tree));
+    reallocate(counts, nNodes(tree), growthRate);
     computeNodeCounts(tree.data(), counts.data(), nNodes(tree), firstKey, lastKey, maxCount);
 
     return converged;
 }
 
+/*! @brief update the octree with a single rebalance/count step
+ *
+ * @tparam       KeyType     32- or 64-bit unsigned integer for SFC code
+ * @param[in]    firstKey    first local particle SFC key
+ * @param[in]    lastKey     last local particle SFC key
+ * @param[in]    bucketSize  maximum number of particles per node
+ * @param[inout] tree        the octree leaf nodes (cornerstone format)
+ * @param[inout] counts      the octree leaf node particle count
+ * @param[in]    maxCount    if actual node counts are higher, they will be capped to @p maxCount
+ * @return                   true if tree was not modified, false otherwise
+ */
+template<class KeyType>
+bool updateOctree(const KeyType* firstKey,
+                  const KeyType* lastKey,
+                  unsigned bucketSize,
+                  std::vector<KeyType>& tree,
+                  std::vector<unsigned>& counts,
+                  unsigned maxCount = std::numeric_limits<unsigned>::max())
+{
+    std::vector<TreeNodeIndex> nodeOps;
+    std::vector<KeyType> tmpTree;
+    return updateOctree(firstKey, lastKey, bucketSize, tree, counts, tmpTree, nodeOps, maxCount);
+}
+
 //! @brief Convenience wrapper for updateOctree. Start from scratch and return a fully converged cornerstone tree.
 template<class KeyType>
 std::tuple<std::vector<KeyType>, std::vector<unsigned>>
@@ -0,0 +1,316 @@
+/*! @file
+ * @brief  Focused octree: full resolution inside and near a focus key range, coarse elsewhere
+ *
+ * @author Sebastian Keller <sebastian.f.keller@gmail.com>
+ *
+ * A focused octree is a cornerstone tree that covers the entire domain, but only resolves nodes down to
+ * bucketSize particles where needed: inside the focus SFC key range, typically the local domain of a rank, and
+ * in its vicinity. Far away from the focus, a node is kept as a leaf as soon as it passes the opening angle
+ * criterion
+ *
+ *      edgeLength(node) < theta * distance(node, focus)
+ *
+ * with the distance measured between the node box and the bounding box of the focus range. The number of leaves
+ * outside the focus therefore grows only logarithmically with the total number of particles, which allows every
+ * rank to hold a compact tree of the whole domain, suitable for gravity and for locating the remote nodes close
+ * to the focus.
+ *
+ * Particle counts of nodes inside the focus are computed from the local particle keys. Counts of the other nodes
+ * are taken from a coarser global tree that is identical on all ranks, such as the one built by
+ * updateOctreeGlobal. Outside the focus, nodes are not split below the resolution of the global tree, since
+ * their counts would not be known.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include "../sfc/box.hpp"
+#include "../sfc/hilbert.hpp"
+#include "../util/reallocate.hpp"
+#include "csarray.hpp"
+#include "octree.hpp"
+
+namespace cstone
+{
+
+/*! @brief compute the bounding box of the SFC key range [focusStart, focusEnd)
+ *
+ * The key range is decomposed into the minimal sequence of octree nodes that covers it exactly,
+ * and the result is the union of the node boxes.
+ */
+template<class KeyType, class T>
+util::tuple<Vec3<T>, Vec3<T>> focusBoundingBox(KeyType focusStart, KeyType focusEnd, const Box<T>& box)
+{
+    Vec3<T> lo{box.xmax(), box.ymax(), box.zmax()};
+    Vec3<T> hi{box.xmin(), box.ymin(), box.zmin()};
+
+    KeyType key = focusStart;
+    while (key < focusEnd)
+    {
+        // largest node that starts at key and does not extend beyond focusEnd
+        unsigned level = 0;
+        while (key % nodeRange<KeyType>(level) != 0 || key + nodeRange<KeyType>(level) > focusEnd)
+        {
+            ++level;
+        }
+
+        auto [center, size] = centerAndSize<KeyType>(hilbertIBox(key, level), box);
+        lo                  = min(lo, center - size);
+        hi                  = max(hi, center + size);
+        key += nodeRange<KeyType>(level);
+    }
+
+    return {T(0.5) * (hi + lo), T(0.5) * (hi - lo)};
+}
+
+/*! @brief rebalance decision for one leaf of a focused octree
+ *
+ * @param[in] tree             focused octree leaves
+ * @param[in] nodeIdx          the leaf to process
+ * @param[in] counts           particle count of each leaf
+ * @param[in] bucketSize       maximum particle count of leaves that do not pass the opening angle criterion
+ * @param[in] focusStart       start of the focus key range
+ * @param[in] focusEnd         end of the focus key range
+ * @param[in] focusCenter      center of the focus bounding box
+ * @param[in] focusSize        extent from center of the focus bounding box
+ * @param[in] thetaSq          squared opening angle
+ * @param[in] globalTree       cornerstone leaves of the global tree, length numGlobalLeaves + 1
+ * @param[in] numGlobalLeaves  number of global leaves
+ * @param[in] box              coordinate bounding box
+ * @return                     0 for merging, 1 for no-change, 8 for splitting
+ *
+ * Like calculateNodeOp, a group of 8 siblings is merged if their combined count does not exceed bucketSize.
+ * In addition, it is merged if the parent lies outside the focus and passes the opening angle criterion.
+ * A leaf is split if it exceeds bucketSize and overlaps the focus or fails the opening angle criterion.
+ */
+template<class KeyType, class T>
+int calculateFocusNodeOp(const KeyType* tree,
+                         TreeNodeIndex nodeIdx,
+                         const unsigned* counts,
+                         unsigned bucketSize,
+                         KeyType focusStart,
+                         KeyType focusEnd,
+                         const Vec3<T>& focusCenter,
+                         const Vec3<T>& focusSize,
+                         T thetaSq,
+                         const KeyType* globalTree,
+                         TreeNodeIndex numGlobalLeaves,
+                         const Box<T>& box)
+{
+    auto overlapsFocus = [focusStart, focusEnd](KeyType nodeStart, KeyType nodeEnd)
+    { return nodeStart < focusEnd && focusStart < nodeEnd; };
+
+    auto passesMac = [&](KeyType nodeStart, unsigned level)
+    {
+        auto [center, size] = centerAndSize<KeyType>(hilbertIBox(nodeStart, level), box);
+        T edgeLength        = T(2) * max(size);
+        T distSq            = norm2(minDistance(center, size, focusCenter, focusSize, box));
+        return edgeLength * edgeLength < thetaSq * distSq;
+    };
+
+    auto [siblingIdx, level] = siblingAndLevel(tree, nodeIdx);
+
+    if (siblingIdx > 0) // 8 siblings next to each other, node can potentially be merged
+    {
+        auto    g           = counts + nodeIdx - siblingIdx;
+        size_t  parentCount = size_t(g[0]) + size_t(g[1]) + size_t(g[2]) + size_t(g[3]) + size_t(g[4]) +
+                             size_t(g[5]) + size_t(g[6]) + size_t(g[7]);
+        KeyType parentStart = tree[nodeIdx - siblingIdx];
+        KeyType parentEnd   = parentStart + nodeRange<KeyType>(level - 1);
+
+        bool countMerge = parentCount <= size_t(bucketSize);
+        bool macMerge   = !overlapsFocus(parentStart, parentEnd) && passesMac(parentStart, level - 1);
+        if (countMerge || macMerge) { return 0; } // merge
+    }
+
+    KeyType nodeStart = tree[nodeIdx];
+    KeyType nodeEnd   = tree[nodeIdx + 1];
+    bool    inFocus   = overlapsFocus(nodeStart, nodeEnd);
+
+    // outside the focus, counts are only known down to the resolution of the global tree
+    auto nextGlobalKey = std::upper_bound(globalTree, globalTree + numGlobalLeaves + 1, nodeStart);
+    bool resolvable    = inFocus || *nextGlobalKey < nodeEnd;
+
+    if (counts[nodeIdx] > bucketSize && level < maxTreeLevel<KeyType>{} && resolvable &&
+        (inFocus || !passesMac(nodeStart, level)))
+    {
+        return 8; // split
+    }
+
+    return 1; // default: do nothing
+}
+
+/*! @brief particle counts of focused octree leaves
+ *
+ * @param[in]  tree             focused octree leaves, length numNodes + 1
+ * @param[out] counts           particle count of each leaf, length numNodes
+ * @param[in]  numNodes         number of leaves
+ * @param[in]  focusStart       start of the focus key range
+ * @param[in]  focusEnd         end of the focus key range
+ * @param[in]  firstKey         first local SFC-sorted particle key, local particles cover the focus range
+ * @param[in]  lastKey          last local SFC-sorted particle key
+ * @param[in]  globalTree       global cornerstone leaves, length numGlobalLeaves + 1
+ * @param[in]  globalCounts     global particle count of each global leaf
+ * @param[in]  numGlobalLeaves  number of global leaves
+ *
+ * Leaves inside the focus are counted exactly with the local keys. The others are assigned the sum of the global
+ * leaves they overlap, which is exact for leaves that consist of whole global leaves and an upper bound for leaves
+ * contained in a single global leaf.
+ */
+template<class KeyType>
+void computeFocusCounts(const KeyType* tree,
+                        unsigned* counts,
+                        TreeNodeIndex numNodes,
+                        KeyType focusStart,
+                        KeyType focusEnd,
+                        const KeyType* firstKey,
+                        const KeyType* lastKey,
+                        const KeyType* globalTree,
+                        const unsigned* globalCounts,
+                        TreeNodeIndex numGlobalLeaves)
+{
+    constexpr size_t maxCount = std::numeric_limits<unsigned>::max();
+
+#pragma omp parallel for schedule(static)
+    for (TreeNodeIndex i = 0; i < numNodes; ++i)
+    {
+        KeyType nodeStart = tree[i];
+        KeyType nodeEnd   = tree[i + 1];
+
+        if (focusStart <= nodeStart && nodeEnd <= focusEnd)
+        {
+            counts[i] = calculateNodeCount(nodeStart, nodeEnd, firstKey, lastKey, maxCount);
+            continue;
+        }
+
+        const KeyType* globalEnd = globalTree + numGlobalLeaves + 1;
+        TreeNodeIndex  first     = std::upper_bound(globalTree, globalEnd, nodeStart) - globalTree - 1;
+        TreeNodeIndex  last      = std::lower_bound(globalTree, globalEnd, nodeEnd) - globalTree;
+
+        size_t count = 0;
+        for (TreeNodeIndex j = first; j < last; ++j)
+        {
+            count += globalCounts[j];
+        }
+        counts[i] = std::min(count, maxCount);
+    }
+}
+
+template<class T, class KeyType>
+class FocusedOctreeCore
+{
+public:
+    /*! @brief construct an empty focused tree
+     *
+     * @param bucketSize  maximum number of particles per leaf inside and near the focus
+     * @param theta       opening angle, leaves outside the focus with edge length < theta * distance to the
+     *                    focus are not split
+     * @param growthRate  over-allocation factor applied whenever a buffer has to grow
+     */
+    FocusedOctreeCore(unsigned bucketSize, T theta, double growthRate = 1.05)
+        : bucketSize_(bucketSize)
+        , theta_(theta)
+        , growthRate_(growthRate)
+    {
+    }
+
+    /*! @brief rebalance the tree for a new focus range or new particle keys until converged
+     *
+     * @param[in] focusStart       start of the focus key range
+     * @param[in] focusEnd         end of the focus key range
+     * @param[in] firstKey         first local SFC-sorted particle key, local particles cover the focus range
+     * @param[in] lastKey          last local SFC-sorted particle key
+     * @param[in] globalTree       global cornerstone leaves, length numGlobalLeaves + 1
+     * @param[in] globalCounts     global particle count of each global leaf
+     * @param[in] numGlobalLeaves  number of global leaves
+     * @param[in] box              coordinate bounding box
+     *
+     * The leaves of the previous call serve as the starting guess. After convergence, the linked octree
+     * and the geometrical node boxes are rebuilt.
+     */
+    void update(KeyType focusStart,
+                KeyType focusEnd,
+                const KeyType* firstKey,
+                const KeyType* lastKey,
+                const KeyType* globalTree,
+                const unsigned* globalCounts,
+                TreeNodeIndex numGlobalLeaves,
+                const Box<T>& box)
+    {
+        if (csTree_.empty())
+        {
+            csTree_ = {0, nodeRange<KeyType>(0)};
+            counts_ = {unsigned(lastKey - firstKey)};
+        }
+
+        auto [focusCenter, focusSize] = focusBoundingBox(focusStart, focusEnd, box);
+
+        bool converged = false;
+        while (!converged)
+        {
+            computeFocusCounts(csTree_.data(), counts_.data(), nNodes(csTree_), focusStart, focusEnd, firstKey,
+                               lastKey, globalTree, globalCounts, numGlobalLeaves);
+
+            TreeNodeIndex numNodes = nNodes(csTree_);
+            reallocate(nodeOps_, numNodes + 1, growthRate_);
+
+            converged = true;
+#pragma omp parallel for schedule(static) reduction(&& : converged)
+            for (TreeNodeIndex i = 0; i < numNodes; ++i)
+            {
+                nodeOps_[i] = calculateFocusNodeOp(csTree_.data(), i, counts_.data(), bucketSize_, focusStart, focusEnd,
+                                                   focusCenter, focusSize, theta_ * theta_, globalTree,
+                                                   numGlobalLeaves, box);
+                converged   = converged && nodeOps_[i] == 1;
+            }
+
+            rebalanceTree(csTree_, tmpTree_, nodeOps_.data());
+            swap(csTree_, tmpTree_);
+            reallocate(counts_, nNodes(csTree_), growthRate_);
+        }
+
+        TreeNodeIndex numLeafNodes = nNodes(csTree_);
+        octree_.resize(numLeafNodes, growthRate_);
+        buildLinkedTree<KeyType>(csTree_.data(), octree_.data());
+
+        reallocate(centers_, octree_.numNodes, growthRate_);
+        reallocate(sizes_, octree_.numNodes, growthRate_);
+        nodeFpCenters(octree_.prefixes.data(), octree_.numNodes, centers_.data(), sizes_.data(), box);
+    }
+
+    //! @brief linked octree connectivity
+    OctreeView<const KeyType> octreeView() const { return octree_.data(); }
+
+    const OctreeData<KeyType, CpuTag>& linkedTree() const { return octree_; }
+    const std::vector<KeyType>& csTree() const { return csTree_; }
+    const std::vector<unsigned>& counts() const { return counts_; }
+    const std::vector<Vec3<T>>& centers() const { return centers_; }
+    const std::vector<Vec3<T>>& sizes() const { return sizes_; }
+
+    unsigned bucketSize() const { return bucketSize_; }
+    T theta() const { return theta_; }
+
+private:
+    unsigned bucketSize_;
+    T theta_;
+    double growthRate_;
+
+    //! @brief cornerstone leaves and their particle counts
+    std::vector<KeyType> csTree_;
+    std::vector<unsigned> counts_;
+
+    //! @brief scratch buffers for the rebalance steps
+    std::vector<KeyType> tmpTree_;
+    std::vector<TreeNodeIndex> nodeOps_;
+
+    OctreeData<KeyType, CpuTag> octree_;
+
+    //! @brief geometrical node centers and sizes, length = octree_.numNodes
+    std::vector<Vec3<T>> centers_;
+    std::vector<Vec3<T>> sizes_;
+};
+
+} // namespace cstone
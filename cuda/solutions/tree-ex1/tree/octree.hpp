@@ -10,11 +10,14 @@
 
 #pragma once
 
+#include <cmath>
 #include <iterator>
+#include <limits>
 #include <vector>
 
 #include "../util/annotation.hpp"
 #include "../util/cuda_utils.hpp"
+#include "../util/reallocate.hpp"
 #include "../util/stl.hpp"
 #include "../util/accel_switch.hpp"
 #include "../sfc/hilbert.hpp"
@@ -97,47 +100,49 @@ void createUnsortedLayoutCpu(const KeyType* leaves,
  *
  * @tparam     KeyType           unsigned 32- or 64-bit integer
  * @param[in]  prefixes          octree node prefixes in Warren-Salmon format
- * @param[in]  numInternalNodes  number of internal octree nodes
- * @param[in]  leafToInternal    translation map from unsorted layout to level/SFC sorted octree layout
- *                               length is total number of octree nodes, internal + leaves
  * @param[in]  levelRange        indices of the first node at each level
  * @param[out] childOffsets      octree node index of first child for each node, length is total number of nodes
  * @param[out] parents           parent index of for each node which is the first of 8 siblings
  *                               i.e. the parent of node i is stored at parents[(i - 1)/8]
+ *
+ * Within each level, nodes are sorted by SFC key and so are the prefixes of their first children. The child
+ * search is therefore done level by level with a merge-path walk over the nodes of two adjacent levels.
  */
 template<class KeyType>
 void linkTreeCpu(const KeyType* prefixes,
-                 TreeNodeIndex numInternalNodes,
-                 const TreeNodeIndex* leafToInternal,
                  const TreeNodeIndex* levelRange,
                  TreeNodeIndex* childOffsets,
                  TreeNodeIndex* parents)
 {
-#pragma omp parallel for schedule(static)
-    for (TreeNodeIndex i = 0; i < numInternalNodes; ++i)
+    for (unsigned level = 0; level < maxTreeLevel<KeyType>{}; ++level)
     {
-        TreeNodeIndex idxA    = leafToInternal[i];
-        KeyType prefix        = prefixes[idxA];
-        KeyType nodeKey       = decodePlaceholderBit(prefix);
-        unsigned prefixLength = decodePrefixLength(prefix);
-        unsigned level        = prefixLength / 3;
-        assert(level < maxTreeLevel<KeyType>{});
-
-        KeyType childPrefix = encodePlaceholderBit(nodeKey, prefixLength + 3);
-
+        TreeNodeIndex levelStart      = levelRange[level];
+        TreeNodeIndex numLevelNodes   = levelRange[level + 1] - levelStart;
         TreeNodeIndex leafSearchStart = levelRange[level + 1];
-        TreeNodeIndex leafSearchEnd   = levelRange[level + 2];
-        TreeNodeIndex childIdx =
-            stl::lower_bound(prefixes + leafSearchStart, prefixes + leafSearchEnd, childPrefix) - prefixes;
+        TreeNodeIndex numChildNodes   = levelRange[level + 2] - leafSearchStart;
+        if (numLevelNodes == 0 || numChildNodes == 0) { continue; }
+
+        auto childPrefix = [prefixes, levelStart, level](std::size_t i)
+        {
+            KeyType nodeKey = decodePlaceholderBit(prefixes[levelStart + i]);
+            return encodePlaceholderBit(nodeKey, 3 * level + 3);
+        };
 
-        if (childIdx != leafSearchEnd && childPrefix == prefixes[childIdx])
+        auto linkChild = [=](std::size_t i, std::size_t first, std::size_t last)
         {
-            childOffsets[idxA] = childIdx;
+            // leaf nodes have no child prefix at the next level
+            if (first == last || prefixes[leafSearchStart + first] != childPrefix(i)) { return; }
+
+            TreeNodeIndex idxA     = levelStart + i;
+            TreeNodeIndex childIdx = leafSearchStart + first;
+            childOffsets[idxA]     = childIdx;
             // We only store the parent once for every group of 8 siblings.
             // This works as long as each node always has 8 siblings.
             // Subtract one because the root has no siblings.
             parents[(childIdx - 1) / 8] = idxA;
-        }
+        };
+
+        mergePathRanges(childPrefix, numLevelNodes, prefixes + leafSearchStart, numChildNodes, linkChild);
     }
 }
 
@@ -147,7 +152,7 @@ void getLevelRangeCpu(const KeyType* nodeKeys, TreeNodeIndex numNodes, TreeNodeI
 {
     for (unsigned level = 0; level <= maxTreeLevel<KeyType>{}; ++level)
     {
-        auto it = std::lower_bound(nodeKeys, nodeKeys + numNodes, encodePlaceholderBit(KeyType(0), 3 * level));
+        auto it = stl::lower_bound(nodeKeys, nodeKeys + numNodes, encodePlaceholderBit(KeyType(0), 3 * level));
         levelRange[level] = TreeNodeIndex(it - nodeKeys);
     }
     levelRange[maxTreeLevel<KeyType>{} + 1] = numNodes;
@@ -182,7 +187,33 @@ void buildOctreeCpu(const KeyType* cstoneTree,
     getLevelRangeCpu(prefixes, numNodes, levelRange);
 
     std::fill(childOffsets, childOffsets + numNodes, 0);
-    linkTreeCpu(prefixes, numInternalNodes, leafToInternal, levelRange, childOffsets, parents);
+    linkTreeCpu(prefixes, levelRange, childOffsets, parents);
+}
+
+/*! @brief compute the escape index of each node for stackless depth-first traversal
+ *
+ * @param[in]  parents        parent index of each group of 8 siblings, see linkTreeCpu
+ * @param[in]  numNodes       total number of nodes, internal + leaves
+ * @param[out] escapeIndices  the next node in depth-first order after the subtree of each node,
+ *                            length @p numNodes
+ *
+ * Siblings are stored next to each other, so the escape index of a node is its next sibling. The last of
+ * 8 siblings inherits the escape index of its parent. The root and the last nodes on the right-most path
+ * of the tree have escape index 0, which marks the end of the traversal.
+ */
+inline void computeEscapeIndicesCpu(const TreeNodeIndex* parents, TreeNodeIndex numNodes, TreeNodeIndex* escapeIndices)
+{
+#pragma omp parallel for schedule(static)
+    for (TreeNodeIndex i = 0; i < numNodes; ++i)
+    {
+        TreeNodeIndex node = i;
+        // node index 0 is the root, all other nodes with (node - 1) % 8 == 7 are the last of their siblings
+        while (node != 0 && (node - 1) % 8 == 7)
+        {
+            node = parents[(node - 1) / 8];
+        }
+        escapeIndices[i] = (node == 0) ? 0 : node + 1;
+    }
 }
 
 //! Octree data view, compatible with GPU data
@@ -206,7 +237,7 @@ struct OctreeView
 template<class T, class KeyType>
 struct OctreeNsView
 {
-    //! @brief geometrical node centers and sizes
+    //! @brief node box centers and sizes, either geometrical or tight bounds of the contained particles
     const Vec3<T>* centers;
     const Vec3<T>* sizes;
 
@@ -217,8 +248,36 @@ struct OctreeNsView
 
     //! @brief index of first particle contained in the node for each leaf node
     const LocalIndex* layout;
+
+    //! @brief optional escape index of each node, see computeEscapeIndicesCpu. If present, the traversal is stackless
+    const TreeNodeIndex* escapeIndices = nullptr;
 };
 
+/*! @brief everything a traversal reads from one node in a single 32-byte record, two nodes per cache line
+ *
+ * The node box is stored in single precision, rounded outwards such that it contains the original box.
+ * Internal nodes store the index of their first child in @a child. Leaves store minus their particle count
+ * instead and the index of their first particle in @a first, such that leaves are the nodes with child <= 0.
+ */
+struct alignas(32) PackedNode
+{
+    Vec3<float>   center;
+    Vec3<float>   size;
+    TreeNodeIndex child;
+    LocalIndex    first;
+
+    HOST_DEVICE_FUN bool isLeaf() const { return child <= 0; }
+
+    //! @brief index of the first child, 0 for leaves, as in OctreeNsView::childOffsets
+    HOST_DEVICE_FUN TreeNodeIndex childOffset() const { return child > 0 ? child : 0; }
+
+    //! @brief particle range [firstParticle():lastParticle()] of a leaf
+    HOST_DEVICE_FUN LocalIndex firstParticle() const { return first; }
+    HOST_DEVICE_FUN LocalIndex lastParticle() const { return first - child; }
+};
+
+static_assert(sizeof(PackedNode) == 32, "PackedNode should fill half a cache line");
+
 template<class KeyType, class Accelerator>
 class OctreeData
 {
@@ -228,21 +287,21 @@ class OctreeData
         typename AccelSwitchType<Accelerator, std::vector, thrust::device_vector>::template type<ValueType>;
 
 public:
-    void resize(TreeNodeIndex numCsLeafNodes)
+    //! @brief resize all arrays for a tree with @p numCsLeafNodes leaves, only allocates if capacity is exceeded
+    void resize(TreeNodeIndex numCsLeafNodes, double growthRate = 1.05)
     {
         numLeafNodes     = numCsLeafNodes;
         numInternalNodes = (numLeafNodes - 1) / 7;
         numNodes         = numLeafNodes + numInternalNodes;
 
-        prefixes.resize(numNodes);
-        internalToLeaf.resize(numNodes);
-        leafToInternal.resize(numNodes);
-        childOffsets.resize(numNodes);
+        reallocate(prefixes, numNodes, growthRate);
+        reallocate(internalToLeaf, numNodes, growthRate);
+        reallocate(leafToInternal, numNodes, growthRate);
         // +1 to accommodate nodeOffsets in FocusedOctreeCore::update when numNodes == 1
-        childOffsets.resize(numNodes + 1);
+        reallocate(childOffsets, numNodes + 1, growthRate);
 
         TreeNodeIndex parentSize = std::max(1, (numNodes - 1) / 8);
-        parents.resize(parentSize);
+        reallocate(parents, parentSize, growthRate);
 
         //+1 due to level 0 and +1 due to the upper bound for the last level
         levelRange.resize(maxTreeLevel<KeyType>{} + 2);
@@ -279,6 +338,9 @@ public:
     AccVector<TreeNodeIndex> internalToLeaf;
     //! @brief maps leaf (cstone) order to internal level-sorted order
     AccVector<TreeNodeIndex> leafToInternal;
+
+    //! @brief optional, empty unless built by buildEscapeIndices, length = numNodes
+    AccVector<TreeNodeIndex> escapeIndices;
 };
 
 template<class KeyType>
@@ -288,6 +350,14 @@ void buildLinkedTree(const KeyType* leaves, OctreeView<KeyType> o)
                    o.internalToLeaf, o.leafToInternal);
 }
 
+//! @brief add escape indices for stackless traversal to a linked octree
+template<class KeyType>
+void buildEscapeIndices(OctreeData<KeyType, CpuTag>& octree, double growthRate = 1.05)
+{
+    reallocate(octree.escapeIndices, octree.numNodes, growthRate);
+    computeEscapeIndicesCpu(octree.parents.data(), octree.numNodes, octree.escapeIndices.data());
+}
+
 /*! @brief compute geometric node centers based on node SFC keys and the global bounding box
  *
  * @tparam KeyType       32- or 64-bit unsigned integer
@@ -312,4 +382,44 @@ void nodeFpCenters(const KeyType* prefixes, TreeNodeIndex numNodes, Vec3<T>* cen
     }
 }
 
+/*! @brief pack node boxes, child offsets and leaf particle ranges into one record per node
+ *
+ * @param[in]  tree      octree connectivity, node boxes and particle layout
+ * @param[in]  numNodes  number of nodes, internal + leaves
+ * @param[out] nodes     packed node records, length = @p numNodes
+ *
+ * Empty nodes of tight bounding boxes keep a negative size, such that they still never overlap anything.
+ */
+template<class T, class KeyType>
+void packNodesCpu(const OctreeNsView<T, KeyType>& tree, TreeNodeIndex numNodes, PackedNode* nodes)
+{
+#pragma omp parallel for schedule(static)
+    for (TreeNodeIndex i = 0; i < numNodes; ++i)
+    {
+        PackedNode& node = nodes[i];
+        for (int d = 0; d < 3; ++d)
+        {
+            T center       = tree.centers[i][d];
+            T size         = tree.sizes[i][d];
+            node.center[d] = float(center);
+            // cover the rounding error of the center, then round the size up
+            T paddedSize = size + std::abs(center - T(node.center[d]));
+            node.size[d] = (size < T(0)) ? -std::numeric_limits<float>::max()
+                                         : std::nextafter(float(paddedSize), std::numeric_limits<float>::max());
+        }
+
+        if (tree.childOffsets[i] == 0)
+        {
+            TreeNodeIndex leafIdx = tree.internalToLeaf[i];
+            node.child            = -TreeNodeIndex(tree.layout[leafIdx + 1] - tree.layout[leafIdx]);
+            node.first            = tree.layout[leafIdx];
+        }
+        else
+        {
+            node.child = tree.childOffsets[i];
+            node.first = 0;
+        }
+    }
+}
+
 } // namespace cstone
@@ -0,0 +1,290 @@
+/*! @file
+ * @brief  Memory-mappable binary file format for cornerstone and linked octrees
+ *
+ * @author Sebastian Keller <sebastian.f.keller@gmail.com>
+ *
+ * File layout: a fixed-size header followed by one section per array. Each section starts at a multiple of
+ * fileSectionAlignment bytes. The header records the byte offset and size of every section, so a reader can
+ * map the file and use all arrays in place, without parsing or copying. Optional sections (particle keys,
+ * layout, node centers and sizes) have size zero if they were not written.
+ *
+ * Values are stored in the native byte order of the writing machine.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+#include "../sfc/box.hpp"
+#include "../util/mapped_file.hpp"
+#include "octree.hpp"
+
+namespace cstone
+{
+
+constexpr char     octreeFileMagic[8] = {'C', 'S', 'O', 'C', 'T', 'R', 'E', 'E'};
+constexpr uint32_t octreeFileVersion  = 1;
+
+//! @brief the arrays stored in an octree file, in file order
+enum OctreeFileSection : int
+{
+    particleKeysSection,
+    csTreeSection,
+    countsSection,
+    prefixesSection,
+    childOffsetsSection,
+    parentsSection,
+    levelRangeSection,
+    internalToLeafSection,
+    leafToInternalSection,
+    layoutSection,
+    centersSection,
+    sizesSection,
+    numOctreeFileSections
+};
+
+struct OctreeFileHeader
+{
+    char     magic[8];
+    uint32_t version;
+    //! @brief sizeof(KeyType) and sizeof(T) of the writer
+    uint32_t keyBytes;
+    uint32_t floatBytes;
+
+    int32_t  numLeafNodes;
+    int32_t  numInternalNodes;
+    int32_t  numNodes;
+    uint64_t numParticles;
+
+    //! @brief the coordinate bounding box: xmin, xmax, ymin, ymax, zmin, zmax and boundary types
+    double  boxLimits[6];
+    int32_t boxBoundaries[3];
+
+    uint64_t sectionOffsets[numOctreeFileSections];
+    uint64_t sectionBytes[numOctreeFileSections];
+};
+
+//! @brief pointers to the arrays to be written to an octree file, optional arrays may be nullptr
+template<class T, class KeyType>
+struct OctreeSnapshot
+{
+    //! @brief SFC-sorted particle keys, optional
+    const KeyType* particleKeys;
+    uint64_t       numParticles;
+
+    //! @brief cornerstone leaves and particle counts, length numLeafNodes + 1 and numLeafNodes
+    const KeyType*  csTree;
+    const unsigned* counts;
+
+    OctreeView<const KeyType> octree;
+
+    //! @brief particle layout, optional, length numLeafNodes + 1
+    const LocalIndex* layout;
+    //! @brief node centers and sizes, optional, length numNodes
+    const Vec3<T>* centers;
+    const Vec3<T>* sizes;
+
+    Box<T> box;
+};
+
+/*! @brief byte size of every octree file section, for the node and particle counts of @p header
+ *
+ * The particle keys section is sized for header.numParticles keys, all other sections are determined by
+ * the number of nodes. Sections that are absent from a file have size zero instead.
+ */
+template<class T, class KeyType>
+void octreeFileSectionBytes(const OctreeFileHeader& header, uint64_t* bytes)
+{
+    uint64_t numNodes   = header.numNodes;
+    uint64_t numLeaves  = header.numLeafNodes;
+    uint64_t numParents = std::max(1, (header.numNodes - 1) / 8);
+
+    bytes[particleKeysSection]   = header.numParticles * sizeof(KeyType);
+    bytes[csTreeSection]         = (numLeaves + 1) * sizeof(KeyType);
+    bytes[countsSection]         = numLeaves * sizeof(unsigned);
+    bytes[prefixesSection]       = numNodes * sizeof(KeyType);
+    bytes[childOffsetsSection]   = numNodes * sizeof(TreeNodeIndex);
+    bytes[parentsSection]        = numParents * sizeof(TreeNodeIndex);
+    bytes[levelRangeSection]     = (maxTreeLevel<KeyType>{} + 2) * sizeof(TreeNodeIndex);
+    bytes[internalToLeafSection] = numNodes * sizeof(TreeNodeIndex);
+    bytes[leafToInternalSection] = numNodes * sizeof(TreeNodeIndex);
+    bytes[layoutSection]         = (numLeaves + 1) * sizeof(LocalIndex);
+    bytes[centersSection]        = numNodes * sizeof(Vec3<T>);
+    bytes[sizesSection]          = numNodes * sizeof(Vec3<T>);
+}
+
+//! @brief true for the sections that are written for every tree, the others are optional
+inline bool isMandatorySection(int section)
+{
+    return section != particleKeysSection && section != layoutSection && section != centersSection &&
+           section != sizesSection;
+}
+
+/*! @brief write an octree snapshot to @p path
+ *
+ * Throws std::runtime_error if the file cannot be written.
+ */
+template<class T, class KeyType>
+void writeOctreeFile(const std::string& path, const OctreeSnapshot<T, KeyType>& s)
+{
+    const auto& o = s.octree;
+
+    OctreeFileHeader header{};
+    std::memcpy(header.magic, octreeFileMagic, sizeof(octreeFileMagic));
+    header.version          = octreeFileVersion;
+    header.keyBytes         = sizeof(KeyType);
+    header.floatBytes       = sizeof(T);
+    header.numLeafNodes     = o.numLeafNodes;
+    header.numInternalNodes = o.numInternalNodes;
+    header.numNodes         = o.numNodes;
+    header.numParticles     = s.numParticles;
+
+    header.boxLimits[0]     = s.box.xmin();
+    header.boxLimits[1]     = s.box.xmax();
+    header.boxLimits[2]     = s.box.ymin();
+    header.boxLimits[3]     = s.box.ymax();
+    header.boxLimits[4]     = s.box.zmin();
+    header.boxLimits[5]     = s.box.zmax();
+    header.boxBoundaries[0] = int32_t(s.box.boundaryX());
+    header.boxBoundaries[1] = int32_t(s.box.boundaryY());
+    header.boxBoundaries[2] = int32_t(s.box.boundaryZ());
+
+    const void* sections[numOctreeFileSections] = {s.particleKeys,   s.csTree,         s.counts,     o.prefixes,
+                                                   o.childOffsets,   o.parents,        o.levelRange, o.internalToLeaf,
+                                                   o.leafToInternal, s.layout,         s.centers,    s.sizes};
+
+    uint64_t bytes[numOctreeFileSections];
+    octreeFileSectionBytes<T, KeyType>(header, bytes);
+
+    uint64_t offset = alignFileOffset(sizeof(OctreeFileHeader));
+    for (int i = 0; i < numOctreeFileSections; ++i)
+    {
+        header.sectionBytes[i]   = sections[i] ? bytes[i] : 0;
+        header.sectionOffsets[i] = offset;
+        offset                   = alignFileOffset(offset + header.sectionBytes[i]);
+    }
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) { throw std::runtime_error("cannot open " + path + " for writing"); }
+
+    const char padding[fileSectionAlignment] = {};
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    uint64_t position = sizeof(header);
+    for (int i = 0; i < numOctreeFileSections; ++i)
+    {
+        out.write(padding, header.sectionOffsets[i] - position);
+        out.write(static_cast<const char*>(sections[i]), header.sectionBytes[i]);
+        position = header.sectionOffsets[i] + header.sectionBytes[i];
+    }
+    out.write(padding, offset - position);
+
+    if (!out) { throw std::runtime_error("error while writing " + path); }
+}
+
+/*! @brief read-only memory mapping of an octree file
+ *
+ * All returned pointers and views point directly into the mapping and remain valid for the lifetime of
+ * the object. Pages are loaded lazily by the operating system on first access. Throws std::runtime_error
+ * if the file cannot be mapped or was written with a different version, key type or floating point type,
+ * if a mandatory section is missing, or if the size of a section does not match the node and particle
+ * counts of the header.
+ */
+template<class T, class KeyType>
+class MappedOctreeFile
+{
+public:
+    explicit MappedOctreeFile(const std::string& path)
+        : file_(path)
+    {
+        const auto& h = header();
+
+        bool valid = file_.size() >= sizeof(OctreeFileHeader) &&
+                     std::memcmp(h.magic, octreeFileMagic, sizeof(octreeFileMagic)) == 0 &&
+                     h.version == octreeFileVersion && h.keyBytes == sizeof(KeyType) && h.floatBytes == sizeof(T);
+        for (int i = 0; valid && i < numOctreeFileSections; ++i)
+        {
+            valid = file_.validSection(h.sectionOffsets[i], h.sectionBytes[i]);
+        }
+        if (!valid) { throw std::runtime_error(path + ": incompatible octree file"); }
+
+        valid = h.numLeafNodes > 0 && h.numInternalNodes >= 0 && h.numNodes == h.numLeafNodes + h.numInternalNodes &&
+                h.numParticles <= file_.size();
+        uint64_t expectedBytes[numOctreeFileSections];
+        octreeFileSectionBytes<T, KeyType>(h, expectedBytes);
+        for (int i = 0; valid && i < numOctreeFileSections; ++i)
+        {
+            bool present = h.sectionBytes[i] > 0;
+            valid        = present ? h.sectionBytes[i] == expectedBytes[i] : !isMandatorySection(i);
+        }
+        if (!valid) { throw std::runtime_error(path + ": truncated or inconsistent octree file"); }
+    }
+
+    const OctreeFileHeader& header() const { return *reinterpret_cast<const OctreeFileHeader*>(file_.data()); }
+
+    uint64_t       numParticles() const { return header().numParticles; }
+    const KeyType* particleKeys() const { return section<KeyType>(particleKeysSection); }
+
+    TreeNodeIndex   numLeafNodes() const { return header().numLeafNodes; }
+    const KeyType*  csTree() const { return section<KeyType>(csTreeSection); }
+    const unsigned* counts() const { return section<unsigned>(countsSection); }
+
+    const LocalIndex* layout() const { return section<LocalIndex>(layoutSection); }
+
+    OctreeView<const KeyType> octreeView() const
+    {
+        const auto& h = header();
+        return {h.numLeafNodes,
+                h.numInternalNodes,
+                h.numNodes,
+                section<KeyType>(prefixesSection),
+                section<TreeNodeIndex>(childOffsetsSection),
+                section<TreeNodeIndex>(parentsSection),
+                section<TreeNodeIndex>(levelRangeSection),
+                section<TreeNodeIndex>(internalToLeafSection),
+                section<TreeNodeIndex>(leafToInternalSection)};
+    }
+
+    //! @brief traversal view, throws std::runtime_error if the optional centers, sizes or layout sections are absent
+    OctreeNsView<T, KeyType> nsView() const
+    {
+        if (!layout() || !section<Vec3<T>>(centersSection) || !section<Vec3<T>>(sizesSection))
+        {
+            throw std::runtime_error("octree file has no node centers, sizes or layout for neighbor searches");
+        }
+        return {section<Vec3<T>>(centersSection), section<Vec3<T>>(sizesSection),
+                section<TreeNodeIndex>(childOffsetsSection), section<TreeNodeIndex>(internalToLeafSection),
+                layout()};
+    }
+
+    Box<T> box() const
+    {
+        const auto& h = header();
+        return {T(h.boxLimits[0]),
+                T(h.boxLimits[1]),
+                T(h.boxLimits[2]),
+                T(h.boxLimits[3]),
+                T(h.boxLimits[4]),
+                T(h.boxLimits[5]),
+                BoundaryType(h.boxBoundaries[0]),
+                BoundaryType(h.boxBoundaries[1]),
+                BoundaryType(h.boxBoundaries[2])};
+    }
+
+private:
+    //! @brief pointer to the start of a section, nullptr if the section is empty
+    template<class V>
+    const V* section(OctreeFileSection s) const
+    {
+        const auto& h = header();
+        return h.sectionBytes[s] ? reinterpret_cast<const V*>(file_.data() + h.sectionOffsets[s]) : nullptr;
+    }
+
+    MappedFile file_;
+};
+
+} // namespace cstone
@@ -0,0 +1,170 @@
+/*! @file
+ * @brief  Persistent octree workspace for repeated tree rebuilds in time-stepping loops
+ *
+ * @author Sebastian Keller <sebastian.f.keller@gmail.com>
+ *
+ * All buffers needed to go from sorted particle SFC keys to a linked octree with geometrical node
+ * centers and a particle layout are owned by OctreeManager and reused across updates. Buffers only grow,
+ * such that once the tree size has stabilized, a rebuild performs no heap allocations.
+ */
+
+#pragma once
+
+#include <limits>
+#include <vector>
+
+#include "../sfc/box.hpp"
+#include "../util/primitives.hpp"
+#include "../util/reallocate.hpp"
+#include "csarray.hpp"
+#include "octree.hpp"
+#include "upsweep.hpp"
+
+namespace cstone
+{
+
+template<class T, class KeyType>
+class OctreeManager
+{
+public:
+    /*! @brief construct an empty workspace
+     *
+     * @param bucketSize  maximum number of particles per leaf node
+     * @param growthRate  over-allocation factor applied whenever a buffer has to grow
+     */
+    explicit OctreeManager(unsigned bucketSize, double growthRate = 1.05)
+        : bucketSize_(bucketSize)
+        , growthRate_(growthRate)
+    {
+    }
+
+    /*! @brief rebuild the tree for a new set of sorted particle keys
+     *
+     * @param[in] firstKey  first SFC-sorted particle key
+     * @param[in] lastKey   last SFC-sorted particle key
+     * @param[in] box       coordinate bounding box that was used to compute the keys
+     *
+     * The cornerstone leaves of the previous call serve as the starting guess, which typically
+     * converges in a single rebalance step if particles have not moved much. The leaf counts of the
+     * starting guess are recomputed for the new keys, such that the first rebalance decision is based on them.
+     */
+    void update(const KeyType* firstKey, const KeyType* lastKey, const Box<T>& box)
+    {
+        if (csTree_.empty())
+        {
+            csTree_ = {0, nodeRange<KeyType>(0)};
+            counts_ = {unsigned(lastKey - firstKey)};
+        }
+        else
+        {
+            computeNodeCounts(csTree_.data(), counts_.data(), nNodes(csTree_), firstKey, lastKey,
+                              std::numeric_limits<unsigned>::max());
+        }
+
+        escapeIndicesValid_ = false;
+        packedNodes_.clear();
+        while (!updateOctree(firstKey, lastKey, bucketSize_, csTree_, counts_, tmpTree_, nodeOps_))
+            ;
+
+        TreeNodeIndex numLeafNodes = nNodes(csTree_);
+        octree_.resize(numLeafNodes, growthRate_);
+        buildLinkedTree<KeyType>(csTree_.data(), octree_.data());
+
+        reallocate(layout_, numLeafNodes + 1, growthRate_);
+        layout_[numLeafNodes] = exclusiveScan(counts_.data(), layout_.data(), numLeafNodes, LocalIndex(0));
+
+        reallocate(centers_, octree_.numNodes, growthRate_);
+        reallocate(sizes_, octree_.numNodes, growthRate_);
+        nodeFpCenters(octree_.prefixes.data(), octree_.numNodes, centers_.data(), sizes_.data(), box);
+    }
+
+    /*! @brief compute tight particle bounding boxes for all nodes of the current tree
+     *
+     * @param[in] x,y,z  SFC-sorted particle coordinates that were used in the last call to update()
+     */
+    void updateTightBoxes(const T* x, const T* y, const T* z)
+    {
+        reallocate(tightCenters_, octree_.numNodes, growthRate_);
+        reallocate(tightSizes_, octree_.numNodes, growthRate_);
+        computeTightBoxes<KeyType>(octree_.levelRange.data(), octree_.childOffsets.data(),
+                                   octree_.internalToLeaf.data(), layout_.data(), x, y, z, tightCenters_.data(),
+                                   tightSizes_.data());
+    }
+
+    /*! @brief pack node boxes, child offsets and leaf particle ranges of the current tree, see PackedNode
+     *
+     * @param[in] tightBoxes  pack the particle bounding boxes from updateTightBoxes() instead of the geometric boxes
+     */
+    void updatePackedNodes(bool tightBoxes = false)
+    {
+        reallocate(packedNodes_, octree_.numNodes, growthRate_);
+        packNodesCpu(tightBoxes ? tightNsView() : nsView(), octree_.numNodes, packedNodes_.data());
+    }
+
+    //! @brief compute escape indices of the current tree, such that neighbor searches on nsView() are stackless
+    void updateEscapeIndices()
+    {
+        buildEscapeIndices(octree_, growthRate_);
+        escapeIndicesValid_ = true;
+    }
+
+    //! @brief linked octree connectivity
+    OctreeView<const KeyType> octreeView() const { return octree_.data(); }
+
+    //! @brief octree connectivity plus node geometry and particle layout for neighbor searches
+    OctreeNsView<T, KeyType> nsView() const
+    {
+        return {centers_.data(), sizes_.data(), octree_.childOffsets.data(), octree_.internalToLeaf.data(),
+                layout_.data(), escapeIndices()};
+    }
+
+    //! @brief like nsView(), but with the tight particle bounding boxes from updateTightBoxes() as node boxes
+    OctreeNsView<T, KeyType> tightNsView() const
+    {
+        return {tightCenters_.data(), tightSizes_.data(), octree_.childOffsets.data(), octree_.internalToLeaf.data(),
+                layout_.data(), escapeIndices()};
+    }
+
+    const OctreeData<KeyType, CpuTag>& linkedTree() const { return octree_; }
+    const std::vector<KeyType>& csTree() const { return csTree_; }
+    const std::vector<unsigned>& counts() const { return counts_; }
+    const std::vector<LocalIndex>& layout() const { return layout_; }
+    const std::vector<Vec3<T>>& centers() const { return centers_; }
+    const std::vector<Vec3<T>>& sizes() const { return sizes_; }
+    const std::vector<Vec3<T>>& tightCenters() const { return tightCenters_; }
+    const std::vector<Vec3<T>>& tightSizes() const { return tightSizes_; }
+    const std::vector<PackedNode>& packedNodes() const { return packedNodes_; }
+
+    unsigned bucketSize() const { return bucketSize_; }
+
+private:
+    //! @brief escape indices from updateEscapeIndices() if they match the current tree, nullptr otherwise
+    const TreeNodeIndex* escapeIndices() const { return escapeIndicesValid_ ? octree_.escapeIndices.data() : nullptr; }
+
+    unsigned bucketSize_;
+    double growthRate_;
+    bool escapeIndicesValid_{false};
+
+    //! @brief cornerstone leaves and their particle counts
+    std::vector<KeyType> csTree_;
+    std::vector<unsigned> counts_;
+
+    //! @brief scratch buffers for updateOctree
+    std::vector<KeyType> tmpTree_;
+    std::vector<TreeNodeIndex> nodeOps_;
+
+    OctreeData<KeyType, CpuTag> octree_;
+
+    //! @brief index of the first particle in each leaf, length = nNodes(csTree_) + 1
+    std::vector<LocalIndex> layout_;
+    //! @brief geometrical node centers and sizes, length = octree_.numNodes
+    std::vector<Vec3<T>> centers_;
+    std::vector<Vec3<T>> sizes_;
+    //! @brief particle bounding box centers and sizes, length = octree_.numNodes
+    std::vector<Vec3<T>> tightCenters_;
+    std::vector<Vec3<T>> tightSizes_;
+    //! @brief node records from updatePackedNodes(), empty after update() until rebuilt
+    std::vector<PackedNode> packedNodes_;
+};
+
+} // namespace cstone
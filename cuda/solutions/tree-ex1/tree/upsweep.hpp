@@ -0,0 +1,174 @@
+/*! @file
+ * @brief  Generic bottom-up accumulation of per-node properties in a linked octree
+ *
+ * @author Sebastian Keller <sebastian.f.keller@gmail.com>
+ *
+ * Nodes of the linked octree are sorted by level, so processing levels from the deepest to the root
+ * guarantees that the properties of all children are available when their parent is computed.
+ * Within each level, all nodes are independent and processed in parallel.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+#include "octree.hpp"
+
+namespace cstone
+{
+
+/*! @brief visit all nodes of a linked octree level by level, from the deepest level up to the root
+ *
+ * @param[in] levelRange      first node index of each tree level, length maxTreeLevel + 2
+ * @param[in] childOffsets    index of the first child of each node, 0 for leaves
+ * @param[in] internalToLeaf  maps linked leaf node indices to cornerstone leaf indices
+ * @param[in] layout          index of the first particle in each cornerstone leaf, length numLeafNodes + 1
+ * @param[in] leafAction      callable (TreeNodeIndex i, LocalIndex first, LocalIndex last) for leaf nodes,
+ *                            [first:last] is the particle range of leaf i
+ * @param[in] internalAction  callable (TreeNodeIndex i, TreeNodeIndex firstChild) for internal nodes
+ *
+ * When an action is invoked for a node, the actions of all its descendants have completed.
+ */
+template<class KeyType, class LeafAction, class InternalAction>
+void upsweepLevels(const TreeNodeIndex* levelRange,
+                   const TreeNodeIndex* childOffsets,
+                   const TreeNodeIndex* internalToLeaf,
+                   const LocalIndex* layout,
+                   LeafAction&& leafAction,
+                   InternalAction&& internalAction)
+{
+    for (int level = maxTreeLevel<KeyType>{}; level >= 0; --level)
+    {
+#pragma omp parallel for schedule(static)
+        for (TreeNodeIndex i = levelRange[level]; i < levelRange[level + 1]; ++i)
+        {
+            TreeNodeIndex firstChild = childOffsets[i];
+            if (firstChild == 0)
+            {
+                TreeNodeIndex leafIdx = internalToLeaf[i];
+                leafAction(i, layout[leafIdx], layout[leafIdx + 1]);
+            }
+            else { internalAction(i, firstChild); }
+        }
+    }
+}
+
+/*! @brief compute an aggregate property for every node of a linked octree, from the leaves up to the root
+ *
+ * @tparam     T               node property type
+ * @param[in]  levelRange      first node index of each tree level, length maxTreeLevel + 2
+ * @param[in]  childOffsets    index of the first child of each node, 0 for leaves
+ * @param[in]  internalToLeaf  maps linked leaf node indices to cornerstone leaf indices
+ * @param[in]  layout          index of the first particle in each cornerstone leaf, length numLeafNodes + 1
+ * @param[out] nodeProps       output property for each node, length = numNodes
+ * @param[in]  leafFn          callable T(LocalIndex first, LocalIndex last), reduces the particles in [first:last]
+ * @param[in]  combineFn       callable T(const T* children), combines the properties of 8 consecutive children
+ */
+template<class KeyType, class T, class LeafFn, class CombineFn>
+void upsweep(const TreeNodeIndex* levelRange,
+             const TreeNodeIndex* childOffsets,
+             const TreeNodeIndex* internalToLeaf,
+             const LocalIndex* layout,
+             T* nodeProps,
+             LeafFn&& leafFn,
+             CombineFn&& combineFn)
+{
+    auto leafAction = [nodeProps, &leafFn](TreeNodeIndex i, LocalIndex first, LocalIndex last)
+    { nodeProps[i] = leafFn(first, last); };
+
+    auto internalAction = [nodeProps, &combineFn](TreeNodeIndex i, TreeNodeIndex firstChild)
+    { nodeProps[i] = combineFn(nodeProps + firstChild); };
+
+    upsweepLevels<KeyType>(levelRange, childOffsets, internalToLeaf, layout, leafAction, internalAction);
+}
+
+//! @brief convenience overload taking the tree connectivity from an octree view
+template<class KeyType, class T, class LeafFn, class CombineFn>
+void upsweep(const OctreeView<const KeyType>& tree,
+             const LocalIndex* layout,
+             T* nodeProps,
+             LeafFn&& leafFn,
+             CombineFn&& combineFn)
+{
+    upsweep<KeyType>(tree.levelRange, tree.childOffsets, tree.internalToLeaf, layout, nodeProps,
+                     std::forward<LeafFn>(leafFn), std::forward<CombineFn>(combineFn));
+}
+
+/*! @brief compute tight axis-aligned bounding boxes of the particles contained in each node
+ *
+ * @param[in]  levelRange      first node index of each tree level
+ * @param[in]  childOffsets    index of the first child of each node, 0 for leaves
+ * @param[in]  internalToLeaf  maps linked leaf node indices to cornerstone leaf indices
+ * @param[in]  layout          index of the first particle in each cornerstone leaf
+ * @param[in]  x,y,z           particle coordinates in SFC order
+ * @param[out] centers         center of the particle bounding box of each node, length = numNodes
+ * @param[out] sizes           half-extent of the particle bounding box of each node, length = numNodes
+ *
+ * Empty nodes get a size of -std::numeric_limits<T>::max(), such that minDistance to any point or box
+ * overflows to infinity and the node never passes an overlap test.
+ */
+template<class KeyType, class T>
+void computeTightBoxes(const TreeNodeIndex* levelRange,
+                       const TreeNodeIndex* childOffsets,
+                       const TreeNodeIndex* internalToLeaf,
+                       const LocalIndex* layout,
+                       const T* x,
+                       const T* y,
+                       const T* z,
+                       Vec3<T>* centers,
+                       Vec3<T>* sizes)
+{
+    constexpr T emptySize = -std::numeric_limits<T>::max();
+
+    auto leafBox = [x, y, z, centers, sizes](TreeNodeIndex i, LocalIndex first, LocalIndex last)
+    {
+        if (first == last)
+        {
+            centers[i] = Vec3<T>{0, 0, 0};
+            sizes[i]   = Vec3<T>{emptySize, emptySize, emptySize};
+            return;
+        }
+
+        Vec3<T> lo{x[first], y[first], z[first]};
+        Vec3<T> hi = lo;
+        for (LocalIndex j = first + 1; j < last; ++j)
+        {
+            Vec3<T> pos{x[j], y[j], z[j]};
+            lo = util::min(lo, pos);
+            hi = util::max(hi, pos);
+        }
+        centers[i] = T(0.5) * (hi + lo);
+        sizes[i]   = T(0.5) * (hi - lo);
+    };
+
+    auto combineBoxes = [centers, sizes](TreeNodeIndex i, TreeNodeIndex firstChild)
+    {
+        T inf = std::numeric_limits<T>::infinity();
+        Vec3<T> lo{inf, inf, inf};
+        Vec3<T> hi{-inf, -inf, -inf};
+        for (TreeNodeIndex c = firstChild; c < firstChild + 8; ++c)
+        {
+            if (sizes[c][0] < 0) { continue; } // empty child
+
+            lo = util::min(lo, centers[c] - sizes[c]);
+            hi = util::max(hi, centers[c] + sizes[c]);
+        }
+
+        if (lo[0] > hi[0])
+        {
+            centers[i] = Vec3<T>{0, 0, 0};
+            sizes[i]   = Vec3<T>{emptySize, emptySize, emptySize};
+        }
+        else
+        {
+            centers[i] = T(0.5) * (hi + lo);
+            sizes[i]   = T(0.5) * (hi - lo);
+        }
+    };
+
+    upsweepLevels<KeyType>(levelRange, childOffsets, internalToLeaf, layout, leafBox, combineBoxes);
+}
+
+} // namespace cstone
@@ -0,0 +1,102 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 CSCS, ETH Zurich
+ *               2021 University of Basel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*! @file
+ * @brief Read-only memory mapping of binary files
+ *
+ * @author Sebastian Keller <sebastian.f.keller@gmail.com>
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace cstone
+{
+
+//! @brief alignment of array sections in binary files, such that mapped arrays start on a cache line
+constexpr uint64_t fileSectionAlignment = 64;
+
+//! @brief round @p offset up to the next multiple of fileSectionAlignment
+constexpr uint64_t alignFileOffset(uint64_t offset)
+{
+    return (offset + fileSectionAlignment - 1) / fileSectionAlignment * fileSectionAlignment;
+}
+
+/*! @brief owns a read-only mapping of an entire file
+ *
+ * Pages are loaded lazily by the operating system on first access. Throws std::runtime_error
+ * if the file cannot be opened or mapped.
+ */
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::string& path)
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) { throw std::runtime_error("cannot open " + path); }
+
+        struct stat fileStat;
+        if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0)
+        {
+            close(fd);
+            throw std::runtime_error("cannot map empty file " + path);
+        }
+
+        size_      = fileStat.st_size;
+        void* addr = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (addr == MAP_FAILED) { throw std::runtime_error("cannot map " + path); }
+        data_ = static_cast<const char*>(addr);
+    }
+
+    MappedFile(const MappedFile&)            = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() { munmap(const_cast<char*>(data_), size_); }
+
+    const char* data() const { return data_; }
+    std::size_t size() const { return size_; }
+
+    //! @brief true if [offset, offset + numBytes) lies inside the file and offset is section-aligned
+    bool validSection(uint64_t offset, uint64_t numBytes) const
+    {
+        return offset % fileSectionAlignment == 0 && offset <= size_ && numBytes <= size_ - offset;
+    }
+
+private:
+    const char* data_{nullptr};
+    std::size_t size_{0};
+};
+
+} // namespace cstone
@@ -0,0 +1,336 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 CSCS, ETH Zurich
+ *               2021 University of Basel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*! @file
+ * @brief Binary particle snapshot files: writer, chunked parallel reader and zero-copy mapping
+ *
+ * @author Sebastian Keller <sebastian.f.keller@gmail.com>
+ *
+ * File layout: a fixed-size header with the particle count, the bounding box and flags, followed by the
+ * x, y, z and optionally h arrays (structure of arrays), each starting at a multiple of fileSectionAlignment
+ * bytes. Values are stored in the native byte order of the writing machine.
+ *
+ * Snapshots flagged as sorted contain particles in SFC order with respect to the stored box. These can be mapped
+ * into memory and used in place with MappedParticleSnapshot, without reading or sorting.
+ */
+
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../sfc/hilbert.hpp"
+#include "mapped_file.hpp"
+#include "stl.hpp"
+
+namespace cstone
+{
+
+constexpr char     particleFileMagic[8] = {'C', 'S', 'P', 'A', 'R', 'T', 'S', 'S'};
+constexpr uint32_t particleFileVersion  = 1;
+
+//! @brief the arrays stored in a particle snapshot, in file order
+enum ParticleFileSection : int
+{
+    xSection,
+    ySection,
+    zSection,
+    hSection,
+    numParticleFileSections
+};
+
+struct ParticleFileHeader
+{
+    char     magic[8];
+    uint32_t version;
+    //! @brief sizeof(T) of the writer
+    uint32_t floatBytes;
+    //! @brief particles are in SFC order with respect to the stored box
+    uint32_t sfcSorted;
+    uint64_t numParticles;
+
+    //! @brief the coordinate bounding box: xmin, xmax, ymin, ymax, zmin, zmax and boundary types
+    double  boxLimits[6];
+    int32_t boxBoundaries[3];
+
+    //! @brief byte offset of each section, h has offset 0 if not present
+    uint64_t sectionOffsets[numParticleFileSections];
+};
+
+namespace detail
+{
+
+inline bool validParticleHeader(const ParticleFileHeader& header, uint32_t floatBytes)
+{
+    return std::memcmp(header.magic, particleFileMagic, sizeof(particleFileMagic)) == 0 &&
+           header.version == particleFileVersion && header.floatBytes == floatBytes;
+}
+
+template<class T>
+Box<T> boxFromHeader(const ParticleFileHeader& h)
+{
+    return {T(h.boxLimits[0]),
+            T(h.boxLimits[1]),
+            T(h.boxLimits[2]),
+            T(h.boxLimits[3]),
+            T(h.boxLimits[4]),
+            T(h.boxLimits[5]),
+            BoundaryType(h.boxBoundaries[0]),
+            BoundaryType(h.boxBoundaries[1]),
+            BoundaryType(h.boxBoundaries[2])};
+}
+
+//! @brief read exactly @p numBytes starting at @p offset, return false on error or end of file
+inline bool preadAll(int fd, char* dest, std::size_t numBytes, uint64_t offset)
+{
+    while (numBytes > 0)
+    {
+        ssize_t numRead = pread(fd, dest, numBytes, offset);
+        if (numRead < 0 && errno == EINTR) { continue; }
+        if (numRead <= 0) { return false; }
+        dest += numRead;
+        offset += numRead;
+        numBytes -= numRead;
+    }
+    return true;
+}
+
+} // namespace detail
+
+/*! @brief write particles to a snapshot file
+ *
+ * @param[in] path          output file name
+ * @param[in] x,y,z         particle coordinates
+ * @param[in] h             smoothing lengths, optional, may be nullptr
+ * @param[in] numParticles  number of particles
+ * @param[in] box           coordinate bounding box
+ * @param[in] sfcSorted     whether the particles are in SFC order with respect to @p box
+ *
+ * Throws std::runtime_error if the file cannot be written.
+ */
+template<class T>
+void writeParticleSnapshot(const std::string& path,
+                           const T* x,
+                           const T* y,
+                           const T* z,
+                           const T* h,
+                           uint64_t numParticles,
+                           const Box<T>& box,
+                           bool sfcSorted)
+{
+    ParticleFileHeader header{};
+    std::memcpy(header.magic, particleFileMagic, sizeof(particleFileMagic));
+    header.version      = particleFileVersion;
+    header.floatBytes   = sizeof(T);
+    header.sfcSorted    = sfcSorted;
+    header.numParticles = numParticles;
+
+    header.boxLimits[0]     = box.xmin();
+    header.boxLimits[1]     = box.xmax();
+    header.boxLimits[2]     = box.ymin();
+    header.boxLimits[3]     = box.ymax();
+    header.boxLimits[4]     = box.zmin();
+    header.boxLimits[5]     = box.zmax();
+    header.boxBoundaries[0] = int32_t(box.boundaryX());
+    header.boxBoundaries[1] = int32_t(box.boundaryY());
+    header.boxBoundaries[2] = int32_t(box.boundaryZ());
+
+    const T* sections[numParticleFileSections] = {x, y, z, h};
+    uint64_t sectionBytes                      = numParticles * sizeof(T);
+
+    uint64_t offset = alignFileOffset(sizeof(ParticleFileHeader));
+    for (int i = 0; i < numParticleFileSections; ++i)
+    {
+        if (sections[i] == nullptr) { continue; }
+        header.sectionOffsets[i] = offset;
+        offset                   = alignFileOffset(offset + sectionBytes);
+    }
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) { throw std::runtime_error("cannot open " + path + " for writing"); }
+
+    const char padding[fileSectionAlignment] = {};
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    uint64_t position = sizeof(header);
+    for (int i = 0; i < numParticleFileSections; ++i)
+    {
+        if (sections[i] == nullptr) { continue; }
+        out.write(padding, header.sectionOffsets[i] - position);
+        out.write(reinterpret_cast<const char*>(sections[i]), sectionBytes);
+        position = header.sectionOffsets[i] + sectionBytes;
+    }
+    out.write(padding, offset - position);
+
+    if (!out) { throw std::runtime_error("error while writing " + path); }
+}
+
+/*! @brief read a particle snapshot and sort it in SFC order
+ *
+ * @param[in]  path       input file name
+ * @param[out] x,y,z      particle coordinates in SFC order
+ * @param[out] h          smoothing lengths in SFC order, left empty if the file does not contain h
+ * @param[out] keys       SFC keys of the particles with respect to the returned box
+ * @param[in]  chunkSize  number of particles per read request
+ * @return                the coordinate bounding box stored in the file
+ *
+ * Chunks are read concurrently with pread by all OpenMP threads. Each thread computes the SFC keys of its
+ * chunk right after reading it, while the coordinates are still in cache, such that the keys are ready for
+ * the sort once the last chunk is in. Files flagged as SFC-sorted skip the sort.
+ * Throws std::runtime_error if the file cannot be read or is incompatible.
+ */
+template<class T, class KeyType>
+Box<T> readParticleSnapshot(const std::string& path,
+                            std::vector<T>& x,
+                            std::vector<T>& y,
+                            std::vector<T>& z,
+                            std::vector<T>& h,
+                            std::vector<KeyType>& keys,
+                            std::size_t chunkSize = 1 << 20)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) { throw std::runtime_error("cannot open " + path); }
+
+    ParticleFileHeader header;
+    if (!detail::preadAll(fd, reinterpret_cast<char*>(&header), sizeof(header), 0) ||
+        !detail::validParticleHeader(header, sizeof(T)))
+    {
+        close(fd);
+        throw std::runtime_error(path + ": incompatible particle file");
+    }
+
+    Box<T>      box     = detail::boxFromHeader<T>(header);
+    std::size_t n       = header.numParticles;
+    bool        readH   = header.sectionOffsets[hSection] != 0;
+    std::size_t nChunks = (n + chunkSize - 1) / chunkSize;
+
+    x.resize(n);
+    y.resize(n);
+    z.resize(n);
+    h.resize(readH ? n : 0);
+    keys.resize(n);
+
+    T* destinations[numParticleFileSections] = {x.data(), y.data(), z.data(), h.data()};
+
+    bool readOk = true;
+#pragma omp parallel for schedule(dynamic)
+    for (std::size_t chunk = 0; chunk < nChunks; ++chunk)
+    {
+        std::size_t first = chunk * chunkSize;
+        std::size_t count = std::min(chunkSize, n - first);
+
+        bool chunkOk = true;
+        for (int s = 0; s < numParticleFileSections; ++s)
+        {
+            if (s == hSection && !readH) { continue; }
+            uint64_t offset = header.sectionOffsets[s] + first * sizeof(T);
+            chunkOk         = chunkOk && detail::preadAll(fd, reinterpret_cast<char*>(destinations[s] + first),
+                                                          count * sizeof(T), offset);
+        }
+        if (!chunkOk)
+        {
+#pragma omp atomic write
+            readOk = false;
+        }
+
+        for (std::size_t i = first; i < first + count; ++i)
+        {
+            keys[i] = hilbert3D<KeyType>(x[i], y[i], z[i], box);
+        }
+    }
+    close(fd);
+
+    if (!readOk) { throw std::runtime_error("error while reading " + path); }
+    if (header.sfcSorted) { return box; }
+
+    std::vector<std::size_t> sfcOrder(n);
+    std::iota(begin(sfcOrder), end(sfcOrder), std::size_t(0));
+    sort_by_key(begin(keys), end(keys), begin(sfcOrder));
+
+    std::vector<T> temp(n);
+    for (auto* array : {&x, &y, &z, &h})
+    {
+        if (array->empty()) { continue; }
+        gather(sfcOrder.data(), n, array->data(), temp.data());
+        swap(*array, temp);
+    }
+
+    return box;
+}
+
+/*! @brief zero-copy access to an SFC-sorted particle snapshot
+ *
+ * The coordinate pointers point directly into a read-only mapping of the file and remain valid for the lifetime
+ * of the object. Throws std::runtime_error if the file is incompatible or not flagged as SFC-sorted.
+ */
+template<class T>
+class MappedParticleSnapshot
+{
+public:
+    explicit MappedParticleSnapshot(const std::string& path)
+        : file_(path)
+    {
+        const auto& h = header();
+
+        bool valid = file_.size() >= sizeof(ParticleFileHeader) && detail::validParticleHeader(h, sizeof(T));
+        for (int i = 0; valid && i < numParticleFileSections; ++i)
+        {
+            if (i == hSection && h.sectionOffsets[i] == 0) { continue; }
+            valid = file_.validSection(h.sectionOffsets[i], h.numParticles * sizeof(T));
+        }
+        if (!valid) { throw std::runtime_error(path + ": incompatible particle file"); }
+        if (!h.sfcSorted) { throw std::runtime_error(path + ": particles are not SFC-sorted, cannot map"); }
+    }
+
+    const ParticleFileHeader& header() const { return *reinterpret_cast<const ParticleFileHeader*>(file_.data()); }
+
+    uint64_t numParticles() const { return header().numParticles; }
+    Box<T>   box() const { return detail::boxFromHeader<T>(header()); }
+
+    const T* x() const { return section(xSection); }
+    const T* y() const { return section(ySection); }
+    const T* z() const { return section(zSection); }
+    //! @brief smoothing lengths, nullptr if not present
+    const T* h() const { return section(hSection); }
+
+private:
+    const T* section(ParticleFileSection s) const
+    {
+        uint64_t offset = header().sectionOffsets[s];
+        return offset ? reinterpret_cast<const T*>(file_.data() + offset) : nullptr;
+    }
+
+    MappedFile file_;
+};
+
+} // namespace cstone
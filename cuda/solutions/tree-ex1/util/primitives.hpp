@@ -0,0 +1,205 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 CSCS, ETH Zurich
+ *               2021 University of Basel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*! @file
+ * @brief  OpenMP-parallel CPU primitives: scans, weighted splitting, stream compaction
+ *
+ * @author Sebastian Keller <sebastian.f.keller@gmail.com>
+ *
+ * All primitives split the input into one contiguous block per thread and operate in two passes:
+ * a per-block reduction followed by a per-block pass that is offset by the (serially scanned) block results.
+ * Below a minimum size, the serial std:: equivalents are used.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace cstone
+{
+
+namespace detail
+{
+
+//! @brief inputs smaller than this are processed serially
+constexpr std::size_t serialThreshold = 1 << 14;
+
+inline int maxThreads()
+{
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+inline int numThreads()
+{
+#ifdef _OPENMP
+    return omp_get_num_threads();
+#else
+    return 1;
+#endif
+}
+
+inline int threadNum()
+{
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+//! @brief the [first, last) element range of block @p blockIdx out of @p numBlocks
+inline std::pair<std::size_t, std::size_t> blockRange(std::size_t numElements, int blockIdx, int numBlocks)
+{
+    std::size_t blockSize = numElements / numBlocks;
+    std::size_t remainder = numElements % numBlocks;
+
+    std::size_t first = blockIdx * blockSize + std::min(std::size_t(blockIdx), remainder);
+    std::size_t last  = first + blockSize + (std::size_t(blockIdx) < remainder);
+    return {first, last};
+}
+
+} // namespace detail
+
+/*! @brief parallel exclusive prefix sum, @p in and @p out may be identical
+ *
+ * @param[in]  in           input sequence
+ * @param[out] out          output sequence, out[i] = init + sum(in[0:i])
+ * @param[in]  numElements  number of elements
+ * @param[in]  init         initial value
+ * @return                  the total sum init + sum(in[0:numElements])
+ */
+template<class T1, class T2>
+T2 exclusiveScan(const T1* in, T2* out, std::size_t numElements, T2 init = T2(0))
+{
+    if (numElements < detail::serialThreshold)
+    {
+        if (numElements == 0) { return init; }
+        T2 lastElement = in[numElements - 1];
+        std::exclusive_scan(in, in + numElements, out, init);
+        return out[numElements - 1] + lastElement;
+    }
+
+    std::vector<T2> blockSums(detail::maxThreads() + 1);
+    T2 total = init;
+
+#pragma omp parallel
+    {
+        int numBlocks           = detail::numThreads();
+        int blockIdx            = detail::threadNum();
+        auto [first, last]      = detail::blockRange(numElements, blockIdx, numBlocks);
+        blockSums[blockIdx + 1] = std::accumulate(in + first, in + last, T2(0));
+
+#pragma omp barrier
+#pragma omp single
+        {
+            blockSums[0] = init;
+            std::inclusive_scan(blockSums.begin(), blockSums.begin() + numBlocks + 1, blockSums.begin());
+            total = blockSums[numBlocks];
+        }
+
+        std::exclusive_scan(in + first, in + last, out + first, blockSums[blockIdx]);
+    }
+
+    return total;
+}
+
+/*! @brief split a sequence into contiguous blocks of equal total weight
+ *
+ * @param[in] weights      non-negative weight of each element, e.g. the measured cost of processing it
+ * @param[in] numElements  number of elements
+ * @param[in] numBlocks    number of blocks
+ * @return                 block boundaries, block b is [splits[b]:splits[b+1]], length @p numBlocks + 1
+ *
+ * Block b starts at the first element at which the weight prefix sum reaches b / numBlocks of the total weight.
+ * The deviation of each block from the average weight is therefore bounded by the heaviest element.
+ */
+template<class T>
+std::vector<std::size_t> weightedBlockRanges(const T* weights, std::size_t numElements, int numBlocks)
+{
+    std::vector<double> weightScan(numElements + 1);
+    weightScan[numElements] = exclusiveScan(weights, weightScan.data(), numElements, 0.0);
+    double totalWeight      = weightScan[numElements];
+
+    std::vector<std::size_t> splits(numBlocks + 1);
+    splits[0]         = 0;
+    splits[numBlocks] = numElements;
+    for (int b = 1; b < numBlocks; ++b)
+    {
+        double target = totalWeight * b / numBlocks;
+        splits[b]     = std::lower_bound(weightScan.begin(), weightScan.end(), target) - weightScan.begin();
+    }
+    return splits;
+}
+
+/*! @brief stable stream compaction: copy all elements that satisfy @p pred to @p out, preserving their order
+ *
+ * @param[in]  in           input sequence
+ * @param[in]  numElements  number of input elements
+ * @param[out] out          output, must not overlap with @p in, needs space for the number of selected elements
+ * @param[in]  pred         unary predicate
+ * @return                  number of elements written to @p out
+ */
+template<class T, class Pred>
+std::size_t copyIf(const T* in, std::size_t numElements, T* out, Pred&& pred)
+{
+    if (numElements < detail::serialThreshold) { return std::copy_if(in, in + numElements, out, pred) - out; }
+
+    std::vector<std::size_t> blockCounts(detail::maxThreads() + 1);
+    std::size_t total = 0;
+
+#pragma omp parallel
+    {
+        int numBlocks             = detail::numThreads();
+        int blockIdx              = detail::threadNum();
+        auto [first, last]        = detail::blockRange(numElements, blockIdx, numBlocks);
+        blockCounts[blockIdx + 1] = std::count_if(in + first, in + last, pred);
+
+#pragma omp barrier
+#pragma omp single
+        {
+            blockCounts[0] = 0;
+            std::inclusive_scan(blockCounts.begin(), blockCounts.begin() + numBlocks + 1, blockCounts.begin());
+            total = blockCounts[numBlocks];
+        }
+
+        std::copy_if(in + first, in + last, out + blockCounts[blockIdx], pred);
+    }
+
+    return total;
+}
+
+} // namespace cstone
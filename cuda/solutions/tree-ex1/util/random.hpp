@@ -36,6 +36,7 @@
 #include <vector>
 
 #include "../sfc/hilbert.hpp"
+#include "distributions.hpp"
 #include "stl.hpp"
 
 namespace cstone
@@ -66,7 +67,31 @@ public:
         std::generate(begin(y_), end(y_), randY);
         std::generate(begin(z_), end(z_), randZ);
 
-        computeSfcKeys(x_.data(), y_.data(), z_.data(), keys_.data(), n, box);
+        sortBySfc();
+    }
+
+    //! @brief parallel generation from one of the distributions in distributions.hpp, see generateParticles
+    RandomCoordinates(size_t n, Box<T> box, ParticleDistribution distribution, uint64_t seed = 42)
+        : box_(std::move(box))
+        , x_(n)
+        , y_(n)
+        , z_(n)
+        , keys_(n)
+    {
+        generateParticles(distribution, x_.data(), y_.data(), z_.data(), n, box_, seed);
+        sortBySfc();
+    }
+
+    const std::vector<T>& x() const { return x_; }
+    const std::vector<T>& y() const { return y_; }
+    const std::vector<T>& z() const { return z_; }
+    const std::vector<KeyType>& keys() const { return keys_; }
+
+private:
+    void sortBySfc()
+    {
+        std::size_t n = x_.size();
+        computeSfcKeys(x_.data(), y_.data(), z_.data(), keys_.data(), n, box_);
 
         std::vector<std::size_t> sfcOrder(n);
         std::iota(begin(sfcOrder), end(sfcOrder), std::size_t(0));
@@ -81,12 +106,6 @@ public:
         swap(z_, temp);
     }
 
-    const std::vector<T>& x() const { return x_; }
-    const std::vector<T>& y() const { return y_; }
-    const std::vector<T>& z() const { return z_; }
-    const std::vector<KeyType>& keys() const { return keys_; }
-
-private:
     Box<T> box_;
     std::vector<T> x_, y_, z_;
     std::vector<KeyType> keys_;
@@ -31,6 +31,7 @@
 
 #include <iostream>
 #include <numeric>
+#include <string>
 
 #include "util/random.hpp"
 #include "tree/octree.hpp"
@@ -58,7 +59,7 @@ void sfcSortParticles(std::vector<T>& x, std::vector<T>& y, std::vector<T>& z, s
     swap(z, temp);
 }
 
-int main()
+int main(int argc, char** argv)
 {
     using KeyType = uint64_t;
     Box<double> box{-1, 1};
@@ -66,7 +67,11 @@ int main()
     unsigned numParticles = 2000000;
     unsigned bucketSize   = 16;
 
-    RandomCoordinates<double, KeyType> coords(numParticles, box);
+    // uniform, plummer, gaussian, clusters, sheets or lattice
+    std::string distributionName = (argc > 1) ? argv[1] : "uniform";
+    std::cout << "particle distribution: " << distributionName << std::endl;
+
+    RandomCoordinates<double, KeyType> coords(numParticles, box, parseDistribution(distributionName));
     std::vector<KeyType>               keys(numParticles);
 
     sfcSortParticles(coords.x(), coords.y(), coords.z(), keys, box);
@@ -44,6 +44,7 @@
 
 #include "../util/annotation.hpp"
 #include "../util/cuda_utils.hpp"
+#include "../util/reallocate.hpp"
 #include "../util/stl.hpp"
 #include "../util/accel_switch.hpp"
 #include "../sfc/hilbert.hpp"
@@ -126,47 +127,49 @@ void createUnsortedLayoutCpu(const KeyType* leaves,
  *
  * @tparam     KeyType           unsigned 32- or 64-bit integer
  * @param[in]  prefixes          octree node prefixes in Warren-Salmon format
- * @param[in]  numInternalNodes  number of internal octree nodes
- * @param[in]  leafToInternal    translation map from unsorted layout to level/SFC sorted octree layout
- *                               length is total number of octree nodes, internal + leaves
  * @param[in]  levelRange        indices of the first node at each level
  * @param[out] childOffsets      octree node index of first child for each node, length is total number of nodes
  * @param[out] parents           parent index of for each node which is the first of 8 siblings
  *                               i.e. the parent of node i is stored at parents[(i - 1)/8]
+ *
+ * Within each level, nodes are sorted by SFC key and so are the prefixes of their first children. The child
+ * search is therefore done level by level with a merge-path walk over the nodes of two adjacent levels.
  */
 template<class KeyType>
 void linkTreeCpu(const KeyType* prefixes,
-                 TreeNodeIndex numInternalNodes,
-                 const TreeNodeIndex* leafToInternal,
                  const TreeNodeIndex* levelRange,
                  TreeNodeIndex* childOffsets,
                  TreeNodeIndex* parents)
 {
-#pragma omp parallel for schedule(static)
-    for (TreeNodeIndex i = 0; i < numInternalNodes; ++i)
+    for (unsigned level = 0; level < maxTreeLevel<KeyType>{}; ++level)
     {
-        TreeNodeIndex idxA    = leafToInternal[i];
-        KeyType prefix        = prefixes[idxA];
-        KeyType nodeKey       = decodePlaceholderBit(prefix);
-        unsigned prefixLength = decodePrefixLength(prefix);
-        unsigned level        = prefixLength / 3;
-        assert(level < maxTreeLevel<KeyType>{});
-
-        KeyType childPrefix = encodePlaceholderBit(nodeKey, prefixLength + 3);
-
+        TreeNodeIndex levelStart      = levelRange[level];
+        TreeNodeIndex numLevelNodes   = levelRange[level + 1] - levelStart;
         TreeNodeIndex leafSearchStart = levelRange[level + 1];
-        TreeNodeIndex leafSearchEnd   = levelRange[level + 2];
-        TreeNodeIndex childIdx =
-            stl::lower_bound(prefixes + leafSearchStart, prefixes + leafSearchEnd, childPrefix) - prefixes;
+        TreeNodeIndex numChildNodes   = levelRange[level + 2] - leafSearchStart;
+        if (numLevelNodes == 0 || numChildNodes == 0) { continue; }
 
-        if (childIdx != leafSearchEnd && childPrefix == prefixes[childIdx])
+        auto childPrefix = [prefixes, levelStart, level](std::size_t i)
         {
-            childOffsets[idxA] = childIdx;
+            KeyType nodeKey = decodePlaceholderBit(prefixes[levelStart + i]);
+            return encodePlaceholderBit(nodeKey, 3 * level + 3);
+        };
+
+        auto linkChild = [=](std::size_t i, std::size_t first, std::size_t last)
+        {
+            // leaf nodes have no child prefix at the next level
+            if (first == last || prefixes[leafSearchStart + first] != childPrefix(i)) { return; }
+
+            TreeNodeIndex idxA     = levelStart + i;
+            TreeNodeIndex childIdx = leafSearchStart + first;
+            childOffsets[idxA]     = childIdx;
             // We only store the parent once for every group of 8 siblings.
             // This works as long as each node always has 8 siblings.
             // Subtract one because the root has no siblings.
             parents[(childIdx - 1) / 8] = idxA;
-        }
+        };
+
+        mergePathRanges(childPrefix, numLevelNodes, prefixes + leafSearchStart, numChildNodes, linkChild);
     }
 }
 
@@ -176,7 +179,7 @@ void getLevelRangeCpu(const KeyType* nodeKeys, TreeNodeIndex numNodes, TreeNodeI
 {
     for (unsigned level = 0; level <= maxTreeLevel<KeyType>{}; ++level)
     {
-        auto it = std::lower_bound(nodeKeys, nodeKeys + numNodes, encodePlaceholderBit(KeyType(0), 3 * level));
+        auto it = stl::lower_bound(nodeKeys, nodeKeys + numNodes, encodePlaceholderBit(KeyType(0), 3 * level));
         levelRange[level] = TreeNodeIndex(it - nodeKeys);
     }
     levelRange[maxTreeLevel<KeyType>{} + 1] = numNodes;
@@ -211,7 +214,7 @@ void buildOctreeCpu(const KeyType* cstoneTree,
     getLevelRangeCpu(prefixes, numNodes, levelRange);
 
     std::fill(childOffsets, childOffsets + numNodes, 0);
-    linkTreeCpu(prefixes, numInternalNodes, leafToInternal, levelRange, childOffsets, parents);
+    linkTreeCpu(prefixes, levelRange, childOffsets, parents);
 }
 
 //! Octree data view, compatible with GPU data
@@ -257,21 +260,21 @@ class OctreeData
         typename AccelSwitchType<Accelerator, std::vector, thrust::device_vector>::template type<ValueType>;
 
 public:
-    void resize(TreeNodeIndex numCsLeafNodes)
+    //! @brief resize all arrays for a tree with @p numCsLeafNodes leaves, only allocates if capacity is exceeded
+    void resize(TreeNodeIndex numCsLeafNodes, double growthRate = 1.05)
     {
         numLeafNodes     = numCsLeafNodes;
         numInternalNodes = (numLeafNodes - 1) / 7;
         numNodes         = numLeafNodes + numInternalNodes;
 
-        prefixes.resize(numNodes);
-        internalToLeaf.resize(numNodes);
-        leafToInternal.resize(numNodes);
-        childOffsets.resize(numNodes);
+        reallocate(prefixes, numNodes, growthRate);
+        reallocate(internalToLeaf, numNodes, growthRate);
+        reallocate(leafToInternal, numNodes, growthRate);
         // +1 to accommodate nodeOffsets in FocusedOctreeCore::update when numNodes == 1
-        childOffsets.resize(numNodes + 1);
+        reallocate(childOffsets, numNodes + 1, growthRate);
 
         TreeNodeIndex parentSize = std::max(1, (numNodes - 1) / 8);
-        parents.resize(parentSize);
+        reallocate(parents, parentSize, growthRate);
 
         //+1 due to level 0 and +1 due to the upper bound for the last level
         levelRange.resize(maxTreeLevel<KeyType>{} + 2);
@@ -0,0 +1,269 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 CSCS, ETH Zurich
+ *               2021 University of Basel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*! @file
+ * @brief Non-uniform particle distributions for benchmarking trees on clustered inputs
+ *
+ * @author Sebastian Keller <sebastian.f.keller@gmail.com>
+ *
+ * Particles are generated in fixed-size blocks, each with its own random engine seeded from the global seed
+ * and the block index. The output therefore only depends on the seed and the particle count, not on the
+ * number of threads. All points lie inside the box: distributions with unbounded support use rejection sampling.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "../sfc/box.hpp"
+
+namespace cstone
+{
+
+enum class ParticleDistribution
+{
+    //! @brief uniform random in the box
+    uniform,
+    //! @brief a single Plummer sphere at the box center
+    plummer,
+    //! @brief a single Gaussian blob at the box center
+    gaussian,
+    //! @brief Gaussian clusters with widths spanning more than an order of magnitude, plus a uniform background
+    clusters,
+    //! @brief a thin sheet and a thin filament intersecting at the box center
+    sheets,
+    //! @brief cubic lattice with small random displacements
+    lattice
+};
+
+//! @brief the distribution with the given name, throws std::invalid_argument for unknown names
+inline ParticleDistribution parseDistribution(const std::string& name)
+{
+    if (name == "uniform") { return ParticleDistribution::uniform; }
+    if (name == "plummer") { return ParticleDistribution::plummer; }
+    if (name == "gaussian") { return ParticleDistribution::gaussian; }
+    if (name == "clusters") { return ParticleDistribution::clusters; }
+    if (name == "sheets") { return ParticleDistribution::sheets; }
+    if (name == "lattice") { return ParticleDistribution::lattice; }
+    throw std::invalid_argument("unknown particle distribution " + name +
+                                ", choose one of uniform, plummer, gaussian, clusters, sheets, lattice");
+}
+
+namespace detail
+{
+
+template<class T>
+bool insideBox(const Vec3<T>& X, const Box<T>& box)
+{
+    return X[0] >= box.xmin() && X[0] < box.xmax() && X[1] >= box.ymin() && X[1] < box.ymax() &&
+           X[2] >= box.zmin() && X[2] < box.zmax();
+}
+
+/*! @brief call drawPoint(engine, i) for each particle i, with one random engine per block of particles
+ *
+ * drawPoint is called repeatedly for the same i until it returns a point inside @p box
+ */
+template<class T, class F>
+void generateBlocked(T* x, T* y, T* z, std::size_t n, const Box<T>& box, uint64_t seed, F&& drawPoint)
+{
+    constexpr std::size_t blockSize = 4096;
+    std::size_t           numBlocks = (n + blockSize - 1) / blockSize;
+
+#pragma omp parallel for schedule(static)
+    for (std::size_t block = 0; block < numBlocks; ++block)
+    {
+        std::seed_seq   seq{uint32_t(seed), uint32_t(seed >> 32), uint32_t(block), uint32_t(block >> 32)};
+        std::mt19937_64 engine(seq);
+
+        std::size_t last = std::min(n, (block + 1) * blockSize);
+        for (std::size_t i = block * blockSize; i < last; ++i)
+        {
+            Vec3<T> X;
+            do
+            {
+                X = drawPoint(engine, i);
+            } while (!insideBox(X, box));
+
+            x[i] = X[0];
+            y[i] = X[1];
+            z[i] = X[2];
+        }
+    }
+}
+
+} // namespace detail
+
+/*! @brief generate particles with the given distribution
+ *
+ * @param[in]  distribution  the distribution to draw from
+ * @param[out] x,y,z         output coordinates, in generation order
+ * @param[in]  n             number of particles
+ * @param[in]  box           all particles are placed inside the box
+ * @param[in]  seed          the output is fully determined by @p seed and @p n
+ *
+ * Length scales are relative to the smallest box dimension L:
+ *  - plummer:  scale radius 0.02 L
+ *  - gaussian: standard deviation 0.05 L
+ *  - clusters: 32 clusters with standard deviations log-uniform in [0.002 L, 0.05 L], containing 90% of
+ *              the particles with equal shares, the remaining 10% are uniform
+ *  - sheets:   sheet normal to z and filament along x with Gaussian thickness 0.005 L, half of the particles each
+ *  - lattice:  ceil(n^(1/3))^3 lattice cells are evenly subsampled, displacements are uniform within +-10% of
+ *              the lattice spacing
+ */
+template<class T>
+void generateParticles(
+    ParticleDistribution distribution, T* x, T* y, T* z, std::size_t n, const Box<T>& box, uint64_t seed)
+{
+    using Engine = std::mt19937_64;
+
+    Vec3<T> lo{box.xmin(), box.ymin(), box.zmin()};
+    Vec3<T> lengths{box.lx(), box.ly(), box.lz()};
+    Vec3<T> center = lo + T(0.5) * lengths;
+    T       L      = std::min({box.lx(), box.ly(), box.lz()});
+
+    auto uniformPoint = [lo, lengths](Engine& engine)
+    {
+        std::uniform_real_distribution<T> u(0, 1);
+        return Vec3<T>{lo[0] + u(engine) * lengths[0], lo[1] + u(engine) * lengths[1], lo[2] + u(engine) * lengths[2]};
+    };
+
+    auto gaussianPoint = [](Engine& engine, const Vec3<T>& mean, T sigma)
+    {
+        std::normal_distribution<T> g(0, sigma);
+        return Vec3<T>{mean[0] + g(engine), mean[1] + g(engine), mean[2] + g(engine)};
+    };
+
+    switch (distribution)
+    {
+        case ParticleDistribution::uniform:
+        {
+            auto draw = [&](Engine& engine, std::size_t) { return uniformPoint(engine); };
+            detail::generateBlocked(x, y, z, n, box, seed, draw);
+            break;
+        }
+        case ParticleDistribution::plummer:
+        {
+            T a = T(0.02) * L;
+
+            auto draw = [&](Engine& engine, std::size_t)
+            {
+                std::uniform_real_distribution<T> u(0, 1);
+                // inverse of the enclosed mass fraction m(r) = r^3 / (r^2 + a^2)^(3/2)
+                T m = std::max(u(engine), std::numeric_limits<T>::min());
+                T r = a / std::sqrt(std::pow(m, T(-2) / 3) - 1);
+
+                T cosTheta = 2 * u(engine) - 1;
+                T sinTheta = std::sqrt(1 - cosTheta * cosTheta);
+                T phi      = 2 * M_PI * u(engine);
+                return center + r * Vec3<T>{sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta};
+            };
+            detail::generateBlocked(x, y, z, n, box, seed, draw);
+            break;
+        }
+        case ParticleDistribution::gaussian:
+        {
+            auto draw = [&](Engine& engine, std::size_t) { return gaussianPoint(engine, center, T(0.05) * L); };
+            detail::generateBlocked(x, y, z, n, box, seed, draw);
+            break;
+        }
+        case ParticleDistribution::clusters:
+        {
+            constexpr int numClusters = 32;
+
+            std::vector<Vec3<T>> clusterCenters(numClusters);
+            std::vector<T>       clusterSigmas(numClusters);
+
+            Engine                            clusterEngine(seed);
+            std::uniform_real_distribution<T> logSigma(std::log(T(0.002) * L), std::log(T(0.05) * L));
+            for (int c = 0; c < numClusters; ++c)
+            {
+                clusterCenters[c] = uniformPoint(clusterEngine);
+                clusterSigmas[c]  = std::exp(logSigma(clusterEngine));
+            }
+
+            auto draw = [&](Engine& engine, std::size_t i)
+            {
+                // every 10th particle belongs to the background, the others cycle through the clusters,
+                // counting only cluster particles such that all clusters get equal shares
+                if (i % 10 == 0) { return uniformPoint(engine); }
+                int c = (i - i / 10 - 1) % numClusters;
+                return gaussianPoint(engine, clusterCenters[c], clusterSigmas[c]);
+            };
+            detail::generateBlocked(x, y, z, n, box, seed, draw);
+            break;
+        }
+        case ParticleDistribution::sheets:
+        {
+            T thickness = T(0.005) * L;
+
+            auto draw = [&](Engine& engine, std::size_t i)
+            {
+                std::normal_distribution<T> g(0, thickness);
+                Vec3<T>                     X = uniformPoint(engine);
+                if (i % 2 == 0) { X[2] = center[2] + g(engine); }
+                else
+                {
+                    X[1] = center[1] + g(engine);
+                    X[2] = center[2] + g(engine);
+                }
+                return X;
+            };
+            detail::generateBlocked(x, y, z, n, box, seed, draw);
+            break;
+        }
+        case ParticleDistribution::lattice:
+        {
+            std::size_t m         = std::ceil(std::cbrt(double(n)));
+            std::size_t numCells  = m * m * m;
+            Vec3<T>     spacing   = lengths * (T(1) / m);
+            T           maxJitter = T(0.1);
+
+            auto draw = [&](Engine& engine, std::size_t i)
+            {
+                std::uniform_real_distribution<T> u(-maxJitter, maxJitter);
+                // spread n particles evenly over the cells if n is not a perfect cube
+                std::size_t cell = i * numCells / n;
+                Vec3<T>     ijk{T(cell / (m * m)), T(cell / m % m), T(cell % m)};
+                Vec3<T>     X;
+                for (int d = 0; d < 3; ++d)
+                {
+                    X[d] = lo[d] + (ijk[d] + T(0.5) + u(engine)) * spacing[d];
+                }
+                return X;
+            };
+            detail::generateBlocked(x, y, z, n, box, seed, draw);
+            break;
+        }
+    }
+}
+
+} // namespace cstone
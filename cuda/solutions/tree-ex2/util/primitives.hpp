@@ -0,0 +1,140 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 CSCS, ETH Zurich
+ *               2021 University of Basel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*! @file
+ * @brief  OpenMP-parallel CPU primitives: scans
+ *
+ * @author Sebastian Keller <sebastian.f.keller@gmail.com>
+ *
+ * All primitives split the input into one contiguous block per thread and operate in two passes:
+ * a per-block reduction followed by a per-block pass that is offset by the (serially scanned) block results.
+ * Below a minimum size, the serial std:: equivalents are used.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace cstone
+{
+
+namespace detail
+{
+
+//! @brief inputs smaller than this are processed serially
+constexpr std::size_t serialThreshold = 1 << 14;
+
+inline int maxThreads()
+{
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+inline int numThreads()
+{
+#ifdef _OPENMP
+    return omp_get_num_threads();
+#else
+    return 1;
+#endif
+}
+
+inline int threadNum()
+{
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+//! @brief the [first, last) element range of block @p blockIdx out of @p numBlocks
+inline std::pair<std::size_t, std::size_t> blockRange(std::size_t numElements, int blockIdx, int numBlocks)
+{
+    std::size_t blockSize = numElements / numBlocks;
+    std::size_t remainder = numElements % numBlocks;
+
+    std::size_t first = blockIdx * blockSize + std::min(std::size_t(blockIdx), remainder);
+    std::size_t last  = first + blockSize + (std::size_t(blockIdx) < remainder);
+    return {first, last};
+}
+
+} // namespace detail
+
+/*! @brief parallel exclusive prefix sum, @p in and @p out may be identical
+ *
+ * @param[in]  in           input sequence
+ * @param[out] out          output sequence, out[i] = init + sum(in[0:i])
+ * @param[in]  numElements  number of elements
+ * @param[in]  init         initial value
+ * @return                  the total sum init + sum(in[0:numElements])
+ */
+template<class T1, class T2>
+T2 exclusiveScan(const T1* in, T2* out, std::size_t numElements, T2 init = T2(0))
+{
+    if (numElements < detail::serialThreshold)
+    {
+        if (numElements == 0) { return init; }
+        T2 lastElement = in[numElements - 1];
+        std::exclusive_scan(in, in + numElements, out, init);
+        return out[numElements - 1] + lastElement;
+    }
+
+    std::vector<T2> blockSums(detail::maxThreads() + 1);
+    T2 total = init;
+
+#pragma omp parallel
+    {
+        int numBlocks           = detail::numThreads();
+        int blockIdx            = detail::threadNum();
+        auto [first, last]      = detail::blockRange(numElements, blockIdx, numBlocks);
+        blockSums[blockIdx + 1] = std::accumulate(in + first, in + last, T2(0));
+
+#pragma omp barrier
+#pragma omp single
+        {
+            blockSums[0] = init;
+            std::inclusive_scan(blockSums.begin(), blockSums.begin() + numBlocks + 1, blockSums.begin());
+            total = blockSums[numBlocks];
+        }
+
+        std::exclusive_scan(in + first, in + last, out + first, blockSums[blockIdx]);
+    }
+
+    return total;
+}
+
+} // namespace cstone
@@ -36,6 +36,7 @@
 #include <vector>
 
 #include "../sfc/hilbert.hpp"
+#include "distributions.hpp"
 #include "stl.hpp"
 
 namespace cstone
@@ -66,6 +67,16 @@ public:
         std::generate(begin(z_), end(z_), randZ);
     }
 
+    //! @brief parallel generation from one of the distributions in distributions.hpp, see generateParticles
+    RandomCoordinates(size_t n, Box<T> box, ParticleDistribution distribution, uint64_t seed = 42)
+        : box_(std::move(box))
+        , x_(n)
+        , y_(n)
+        , z_(n)
+    {
+        generateParticles(distribution, x_.data(), y_.data(), z_.data(), n, box_, seed);
+    }
+
     std::vector<T>& x() { return x_; }
     std::vector<T>& y() { return y_; }
     std::vector<T>& z() { return z_; }
@@ -0,0 +1,60 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 CSCS, ETH Zurich
+ *               2021 University of Basel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*! @file
+ * @brief Capacity-aware resizing of vectors that are reused across tree rebuilds
+ *
+ * @author Sebastian Keller <sebastian.f.keller@gmail.com>
+ */
+
+#pragma once
+
+#include <cstddef>
+
+namespace cstone
+{
+
+/*! @brief resize a vector to @p size, reserving extra space if the current capacity is exceeded
+ *
+ * @param[inout] vector      a vector-like container with capacity(), reserve() and resize() members
+ * @param[in]    size        the new size
+ * @param[in]    growthRate  reserve @p size * @p growthRate elements if a reallocation is necessary
+ *
+ * Shrinking never releases memory, so a buffer that oscillates in size across time steps
+ * only allocates when it exceeds its previous maximum.
+ */
+template<class Vector>
+void reallocate(Vector& vector, std::size_t size, double growthRate)
+{
+    std::size_t currentCapacity = vector.capacity();
+    if (size > currentCapacity)
+    {
+        std::size_t reserveSize = double(size) * growthRate;
+        vector.reserve(reserveSize);
+    }
+    vector.resize(size);
+}
+
+} // namespace cstone
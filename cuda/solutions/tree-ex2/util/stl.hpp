@@ -190,4 +190,83 @@ void gather(const IndexType* ordering, std::size_t numElements, const ValueType*
     }
 }
 
+/*! @brief find the merge-path split point at position @p diag of the merged key and data sequences
+ *
+ * @return  the number of keys, accessed through @p keyAt, that precede position @p diag in the merged sequence
+ *
+ * In the merged sequence, a key precedes all data elements that compare equal to it.
+ */
+template<class KeyFn, class T>
+std::size_t mergePathSplit(KeyFn&& keyAt, std::size_t numKeys, const T* data, std::size_t numData, std::size_t diag)
+{
+    std::size_t lo = diag > numData ? diag - numData : 0;
+    std::size_t hi = std::min(diag, numKeys);
+    while (lo < hi)
+    {
+        std::size_t i = (lo + hi) / 2;
+        if (keyAt(i) <= data[diag - i - 1]) { lo = i + 1; }
+        else { hi = i; }
+    }
+    return lo;
+}
+
+/*! @brief partition a sorted sequence into the ranges delimited by a second sorted sequence of keys
+ *
+ * @param[in] keyAt        callable returning the i-th key, keys must be sorted in ascending order
+ * @param[in] numKeys      number of keys
+ * @param[in] data         sorted data sequence to partition
+ * @param[in] numData      number of elements in @p data
+ * @param[in] f            callable, invoked as f(i, first, last) for each key i, where
+ *                         first = lower_bound(data, keys[i]) and last = lower_bound(data, keys[i+1]),
+ *                         or last = @p numData for the last key
+ * @param[in] segmentSize  number of elements of the merged sequence processed per parallel task
+ *
+ * Instead of two independent binary searches per key, both sequences are walked together in merge order.
+ * The merged sequence is cut into segments of equal length whose start points are located with one
+ * binary search each, such that the total cost is O(numKeys + numData) with a balanced load across threads,
+ * regardless of how the data elements are distributed over the keys.
+ */
+template<class KeyFn, class T, class F>
+void mergePathRanges(KeyFn&& keyAt, std::size_t numKeys, const T* data, std::size_t numData, F&& f,
+                     std::size_t segmentSize = 4096)
+{
+    std::size_t totalSize   = numKeys + numData;
+    std::size_t numSegments = (totalSize + segmentSize - 1) / segmentSize;
+
+#pragma omp parallel for schedule(static)
+    for (std::size_t seg = 0; seg < numSegments; ++seg)
+    {
+        std::size_t diagStart = seg * segmentSize;
+        std::size_t diagEnd   = std::min(diagStart + segmentSize, totalSize);
+
+        std::size_t keyStart = mergePathSplit(keyAt, numKeys, data, numData, diagStart);
+        std::size_t keyEnd   = mergePathSplit(keyAt, numKeys, data, numData, diagEnd);
+        if (keyStart == keyEnd) { continue; }
+
+        // advance to the lower bound of the first key owned by this segment
+        std::size_t j = diagStart - keyStart;
+        auto key      = keyAt(keyStart);
+        while (j < numData && data[j] < key)
+        {
+            ++j;
+        }
+
+        for (std::size_t i = keyStart; i < keyEnd - 1; ++i)
+        {
+            std::size_t first = j;
+            auto nextKey      = keyAt(i + 1);
+            while (j < numData && data[j] < nextKey)
+            {
+                ++j;
+            }
+            f(i, first, j);
+        }
+
+        // the range of the last key may extend into the following segments, locate its end with a binary search
+        std::size_t last = numData;
+        if (keyEnd < numKeys) { last = stl::lower_bound(data + j, data + numData, keyAt(keyEnd)) - data; }
+        f(keyEnd - 1, j, last);
+    }
+}
+
 } // namespace cstone
\ No newline at end of file